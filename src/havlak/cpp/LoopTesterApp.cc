@@ -16,29 +16,41 @@
 #include <chrono>
 #include <list>
 #include <map>
+#include <math.h>
+#include <memory>
+#include <random>
 #include <set>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
 #include <vector>
 
+#include "closure-loops.h"
+#include "fast-havlak-loops.h"
 #include "fwbw-loops.h"
+#include "loop-workspace.h"
+#include "mao-loops-inl.h"
 #include "mao-loops.h"
+#include "multistep-loops.h"
 #include "tarjan-loops.h"
+#include "thread-pool.h"
 
 using namespace std;
 
 int buildDiamond(MaoCFG *cfg, int start) {
     int bb0 = start;
 
-    new BasicBlockEdge(cfg, bb0, bb0 + 1);
-    new BasicBlockEdge(cfg, bb0, bb0 + 2);
-    new BasicBlockEdge(cfg, bb0 + 1, bb0 + 3);
-    new BasicBlockEdge(cfg, bb0 + 2, bb0 + 3);
+    cfg->CreateEdge(bb0, bb0 + 1);
+    cfg->CreateEdge(bb0, bb0 + 2);
+    cfg->CreateEdge(bb0 + 1, bb0 + 3);
+    cfg->CreateEdge(bb0 + 2, bb0 + 3);
 
     return bb0 + 3;
 }
 
 void buildConnect(MaoCFG *cfg, int start, int end) {
-    new BasicBlockEdge(cfg, start, end);
+    cfg->CreateEdge(start, end);
 }
 
 int buildStraight(MaoCFG *cfg, int start, int n) {
@@ -195,6 +207,98 @@ int buildScalableSCCs(MaoCFG *cfg, int numSCCs) {
     return current;
 }
 
+/*
+while (true) {                // header
+    if (c1) {} else {}        // diamond 1
+    ...
+    if (cn) {} else {}        // diamond n
+}
+*/
+int buildLargeLoopBody(MaoCFG *cfg, int from, int diamonds) {
+    int header = buildStraight(cfg, from, 1);
+    int n = header;
+    for (int i = 0; i < diamonds; i++)
+        n = buildDiamond(cfg, n);
+    buildConnect(cfg, n, header); // back edge
+    return buildStraight(cfg, n, 1);
+}
+
+/*
+for (...) {                   // level 1
+    for (...) {               // level 2
+        ...                   // down to level 'depth'
+    }
+}
+*/
+int buildDeepNest(MaoCFG *cfg, int from, int depth) {
+    vector<int> headers;
+    int n = from;
+    for (int i = 0; i < depth; i++) {
+        n = buildStraight(cfg, n, 1);
+        headers.push_back(n);
+    }
+    n = buildStraight(cfg, n, 1); // innermost body
+    for (int i = depth - 1; i >= 0; i--) {
+        n = buildStraight(cfg, n, 1);
+        buildConnect(cfg, n, headers[i]); // back edge of level i
+    }
+    return buildStraight(cfg, n, 1);
+}
+
+// A random CFG of 'blocks' blocks, named from 0, that the start block 0
+// reaches through a random tree, plus random edges that make it
+// irreducible. 'deadBlocks' more blocks, named after those, are linked
+// at random among themselves and into the others, but the start block
+// does not reach them.
+void buildRandomGraph(MaoCFG *cfg, unsigned seed, int blocks, int deadBlocks) {
+    mt19937 random(seed);
+    cfg->CreateNode(0);
+    for (int i = 1; i < blocks; i++)
+        buildConnect(cfg, random() % i, i);
+    for (int i = 0; i < blocks; i++)
+        buildConnect(cfg, random() % blocks, random() % blocks);
+
+    for (int i = 0; i < deadBlocks; i++) {
+        int dead = blocks + i;
+        cfg->CreateNode(dead);
+        buildConnect(cfg, dead, blocks + random() % deadBlocks);
+        buildConnect(cfg, blocks + random() % deadBlocks, dead);
+        buildConnect(cfg, dead, random() % blocks);
+    }
+}
+
+// the simple CFG: top (0), a base loop, and bottom (1)
+void buildSimpleCFG(MaoCFG *cfg) {
+    cfg->CreateNode(0); // top
+    buildBaseLoop(cfg, 0);
+    cfg->CreateNode(1); // bottom
+    cfg->CreateEdge(0, 2);
+}
+
+// grow the simple CFG into the complex one: 'trees' parallel trees of
+// 100 loops, each around a run of 25 base loops
+void addLoopTrees(MaoCFG *cfg, int trees) {
+    int n = 2;
+
+    for (int parlooptrees = 0; parlooptrees < trees; parlooptrees++) {
+        cfg->CreateNode(n + 1);
+        buildConnect(cfg, 2, n + 1);
+        n = n + 1;
+
+        for (int i = 0; i < 100; i++) {
+            int top = n;
+            n = buildStraight(cfg, n, 1);
+            for (int j = 0; j < 25; j++) {
+                n = buildBaseLoop(cfg, n);
+            }
+            int bottom = buildStraight(cfg, n, 1);
+            buildConnect(cfg, n, top);
+            n = bottom;
+        }
+        buildConnect(cfg, n, 1);
+    }
+}
+
 // run tests with SCC counts 32-8192
 void runScalingSCCTests() {
     fprintf(stderr, "\n=== Testing Scalable SCC Counts ===\n");
@@ -208,28 +312,237 @@ void runScalingSCCTests() {
         MaoCFG cfg;
         buildScalableSCCs(&cfg, count);
 
-        // Test with FWBW algorithm
-        LoopStructureGraph lsg;
+        // Test with FWBW algorithm, with each pivot strategy. Partitions
+        // keep being split rather than finished by the serial search,
+        // which would take over all of them without workers to share them.
+        FWBWPivot pivots[] = {kPivotFirst, kPivotDegree, kPivotRandom, kPivotSampled};
+        for (FWBWPivot pivot : pivots) {
+            FWBWStats stats;
+            FWBWOptions options;
+            options.pivot = pivot;
+            options.serial = false;
+            options.stats = &stats;
+            LoopStructureGraph lsg;
+            auto start = chrono::high_resolution_clock::now();
+            CSRGraph graph;
+            cfg.BuildSnapshot(&graph);
+            int loops = FindFWBWLoops(graph, &lsg, options);
+            auto end = chrono::high_resolution_clock::now();
+
+            fprintf(stderr, "FWBW (%s) found %d loops in %.2f ms, "
+                    "%llu splits around %llu pivots, depth %d, imbalance %.2f, "
+                    "%llu tasks, %llu serial\n",
+                    FWBWPivotName(pivot), loops,
+                    chrono::duration<double, milli>(end - start).count(),
+                    (unsigned long long)stats.splits,
+                    (unsigned long long)stats.pivots, stats.depth,
+                    stats.Imbalance(), (unsigned long long)stats.tasks,
+                    (unsigned long long)stats.serial);
+        }
+
+        LoopStructureGraph lsg2;
         auto start = chrono::high_resolution_clock::now();
-        // int loops = FindFWBWLoops(&cfg, &lsg);
-        int loops = 0;
+        int loops = FindTarjanLoops(&cfg, &lsg2);
         auto end = chrono::high_resolution_clock::now();
 
-        chrono::duration<double, milli> duration = end - start;
+        fprintf(stderr, "Tarjan found %d loops in %.2f ms\n",
+                loops, chrono::duration<double, milli>(end - start).count());
+
+        LoopStructureGraph lsg3;
+        start = chrono::high_resolution_clock::now();
+        loops = FindMultistepLoops(&cfg, &lsg3);
+        end = chrono::high_resolution_clock::now();
 
-        fprintf(stderr, "FWBW found %d loops (expected %d) in %.2f ms\n",
-                loops, count + 1, duration.count()); // +1 for artificial root
+        fprintf(stderr, "Multistep found %d loops in %.2f ms\n",
+                loops, chrono::duration<double, milli>(end - start).count());
 
-        LoopStructureGraph lsg2;
+        LoopStructureGraph lsg4;
         start = chrono::high_resolution_clock::now();
-        loops = FindTarjanLoops(&cfg, &lsg2);
+        loops = FindParallelHavlakLoops(&cfg, &lsg4);
         end = chrono::high_resolution_clock::now();
 
-        fprintf(stderr, "Tarjan found %d loops in %.2f ms\n",
+        fprintf(stderr, "Parallel Havlak found %d loops in %.2f ms\n",
                 loops, chrono::duration<double, milli>(end - start).count());
     }
 }
 
+// whether a path of one or more edges leads from 'from' to 'to', by a
+// search; 'seen' holds the last query each node was reached in
+bool reachesBySearch(const CSRGraph &graph, CSRGraph::NodeId from, CSRGraph::NodeId to,
+                     int query, vector<int> *seen, vector<CSRGraph::NodeId> *stack) {
+    stack->assign(1, from);
+    while (!stack->empty()) {
+        CSRGraph::NodeId node = stack->back();
+        stack->pop_back();
+        for (CSRGraph::NodeId succ : graph.out_edges(node)) {
+            if (succ == to)
+                return true;
+            if ((*seen)[succ] == query)
+                continue;
+            (*seen)[succ] = query;
+            stack->push_back(succ);
+        }
+    }
+    return false;
+}
+
+// milliseconds the fastest of 'rounds' calls of 'run' takes
+template <typename Run>
+double fastestMs(int rounds, Run run) {
+    double best = 0;
+    for (int round = 0; round < rounds; round++) {
+        auto start = chrono::high_resolution_clock::now();
+        run();
+        auto end = chrono::high_resolution_clock::now();
+        double ms = chrono::duration<double, milli>(end - start).count();
+        if (!round || ms < best)
+            best = ms;
+    }
+    return best;
+}
+
+// The closure engine on the graphs its matrix takes, up to
+// kMaxClosureNodes nodes. Its loops are Tarjan's, found in the same
+// search, so it only pays off through the queries the closure answers
+// afterwards: each is a bit read, where without it each is a search.
+void runClosureBandTests() {
+    fprintf(stderr, "\n=== Testing the Closure Engine ===\n");
+
+    // 348 to 8096 nodes
+    const int kQueries = 4096;
+    const int kRounds = 5;
+    int testCounts[] = {32, 128, 512, 736};
+
+    for (int count : testCounts) {
+        MaoCFG cfg;
+        buildScalableSCCs(&cfg, count);
+        CSRGraph graph;
+        cfg.BuildSnapshot(&graph);
+        fprintf(stderr, "\nTesting with %d SCCs, %d nodes...\n", count, graph.GetNumNodes());
+
+        // the same random queries for both
+        mt19937 random(count);
+        uniform_int_distribution<CSRGraph::NodeId> pick(0, graph.GetNumNodes() - 1);
+        vector<pair<CSRGraph::NodeId, CSRGraph::NodeId> > queries;
+        for (int i = 0; i < kQueries; i++)
+            queries.push_back(make_pair(pick(random), pick(random)));
+
+        int loops = 0;
+        double tarjanMs = fastestMs(kRounds, [&] {
+            LoopStructureGraph lsg;
+            loops = FindTarjanLoops(graph, &lsg);
+        });
+
+        vector<int> seen;
+        vector<CSRGraph::NodeId> stack;
+        vector<bool> expected(kQueries);
+        double searchUs = fastestMs(kRounds, [&] {
+            seen.assign(graph.GetNumNodes(), -1);
+            for (int i = 0; i < kQueries; i++)
+                expected[i] = reachesBySearch(graph, queries[i].first, queries[i].second, i,
+                                              &seen, &stack);
+        }) * 1000 / kQueries;
+
+        fprintf(stderr, "Tarjan found %d loops in %.2f ms, %.3f us per query by search\n",
+                loops, tarjanMs, searchUs);
+
+        // the widest row kernel the CPU has and the scalar one
+        ClosureKernel kernels[] = {ResolveClosureKernel(kClosureAuto), kClosureScalar};
+        for (ClosureKernel kernel : kernels) {
+            ReachabilityClosure closure;
+            ClosureOptions options;
+            options.closure = &closure;
+            options.kernel = kernel;
+            double closureMs = fastestMs(kRounds, [&] {
+                LoopStructureGraph lsg;
+                loops = FindClosureLoops(graph, &lsg, options);
+            });
+
+            int wrong = 0;
+            double closureUs = fastestMs(kRounds, [&] {
+                wrong = 0;
+                for (int i = 0; i < kQueries; i++)
+                    wrong += closure.Reaches(queries[i].first, queries[i].second) != expected[i];
+            }) * 1000 / kQueries;
+
+            // queries after which the closure has paid for itself
+            double saved = searchUs - closureUs;
+            double breakEven = (closureMs - tarjanMs) * 1000 / saved;
+            fprintf(stderr, "Closure (%s) found %d loops in %.2f ms, %.3f us per query, "
+                    "ahead after %.0f queries, %d wrong answers\n",
+                    ClosureKernelName(kernel), loops, closureMs, closureUs,
+                    saved > 0 ? max(breakEven, 0.0) : INFINITY, wrong);
+        }
+    }
+}
+
+// Havlak on straight-line chains, iterative vs. recursive DFS numbering.
+// The recursive numbering needs one native stack frame per block, so it
+// is only run on chains that fit into a default stack.
+void runDeepChainTests() {
+    fprintf(stderr, "\n=== Testing Deep Chains (Havlak DFS) ===\n");
+
+    const int kMaxRecursiveChain = 10000;
+    int chainLengths[] = {1000, 10000, 100000, 1000000};
+
+    for (int length : chainLengths) {
+        MaoCFG cfg;
+        cfg.CreateNode(0);
+        buildStraight(&cfg, 0, length);
+        CSRGraph graph;
+        cfg.BuildSnapshot(&graph);
+
+        LoopStructureGraph lsg;
+        auto start = chrono::high_resolution_clock::now();
+        FindHavlakLoops(graph, &lsg);
+        auto end = chrono::high_resolution_clock::now();
+        fprintf(stderr, "Chain of %d blocks: iterative %.2f ms",
+                length, chrono::duration<double, milli>(end - start).count());
+
+        if (length <= kMaxRecursiveChain) {
+            LoopStructureGraph lsg2;
+            start = chrono::high_resolution_clock::now();
+            FindHavlakLoopsRecursiveDFS(graph, &lsg2);
+            end = chrono::high_resolution_clock::now();
+            fprintf(stderr, ", recursive %.2f ms\n",
+                    chrono::duration<double, milli>(end - start).count());
+        } else {
+            fprintf(stderr, ", recursive skipped (stack depth)\n");
+        }
+    }
+}
+
+// one loop whose body is a run of diamonds, so every body block is
+// collected into Havlak's node pool for the same header
+void runLargeLoopBodyTests() {
+    fprintf(stderr, "\n=== Testing Large Loop Bodies (Havlak engines) ===\n");
+
+    int diamondCounts[] = {1000, 3000, 10000};
+
+    for (int diamonds : diamondCounts) {
+        MaoCFG cfg;
+        cfg.CreateNode(0);
+        buildLargeLoopBody(&cfg, 0, diamonds);
+        CSRGraph graph;
+        cfg.BuildSnapshot(&graph);
+
+        LoopStructureGraph lsg;
+        auto start = chrono::high_resolution_clock::now();
+        FindHavlakLoops(graph, &lsg);
+        auto end = chrono::high_resolution_clock::now();
+        fprintf(stderr, "Loop of %d blocks: havlak %.2f ms",
+                3 * diamonds + 1,
+                chrono::duration<double, milli>(end - start).count());
+
+        LoopStructureGraph lsg2;
+        start = chrono::high_resolution_clock::now();
+        FindFastHavlakLoops(graph, &lsg2);
+        end = chrono::high_resolution_clock::now();
+        fprintf(stderr, ", fast havlak %.2f ms\n",
+                chrono::duration<double, milli>(end - start).count());
+    }
+}
+
 // compare all algorithms with a given number of SCCs
 void compareAllAlgorithms(int count) {
     fprintf(stderr, "\n=== Comparing All Algorithms with %d SCCs ===\n", count);
@@ -254,10 +567,578 @@ void compareAllAlgorithms(int count) {
             loops, chrono::duration<double, milli>(end - start).count());
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////BENCHMARK DRIVER///////////////////////////////////
+
+// a loop finder the benchmark can select; all run on a CSR snapshot, so
+// the timings leave out building the snapshot. 'workspace' may be NULL.
+struct BenchmarkEngine {
+    const char *name;
+    int (*find)(const CSRGraph &graph, LoopStructureGraph *lsg, ThreadPool *pool,
+                LoopAnalysisWorkspace *workspace);
+
+    // for engines that take different paths by graph, the one 'graph'
+    // takes; NULL for the others
+    const char *(*path)(const CSRGraph &graph);
+};
+
+int runHavlak(const CSRGraph &graph, LoopStructureGraph *lsg, ThreadPool *,
+              LoopAnalysisWorkspace *workspace) {
+    return FindHavlakLoops(graph, lsg, workspace);
+}
+
+// the bit-parallel finder on graphs small enough for it, else Havlak
+int runSmall(const CSRGraph &graph, LoopStructureGraph *lsg, ThreadPool *,
+             LoopAnalysisWorkspace *workspace) {
+    return FindLoopsAuto(graph, lsg, workspace);
+}
+
+const char *smallPath(const CSRGraph &graph) {
+    return FitsSmallLoops(graph) ? "bitset" : "havlak";
+}
+
+int runFastHavlak(const CSRGraph &graph, LoopStructureGraph *lsg, ThreadPool *,
+                  LoopAnalysisWorkspace *workspace) {
+    return FindFastHavlakLoops(graph, lsg, workspace);
+}
+
+int runParallelHavlak(const CSRGraph &graph, LoopStructureGraph *lsg, ThreadPool *pool,
+                      LoopAnalysisWorkspace *workspace) {
+    ParallelHavlakOptions options;
+    options.pool = pool;
+    options.workspace = workspace;
+    return FindParallelHavlakLoops(graph, lsg, options);
+}
+
+int runTarjan(const CSRGraph &graph, LoopStructureGraph *lsg, ThreadPool *,
+              LoopAnalysisWorkspace *workspace) {
+    return FindTarjanLoops(graph, lsg, workspace);
+}
+
+int runFWBW(const CSRGraph &graph, LoopStructureGraph *lsg, ThreadPool *pool,
+            LoopAnalysisWorkspace *workspace) {
+    FWBWOptions options;
+    options.pool = pool;
+    options.workspace = workspace;
+    return FindFWBWLoops(graph, lsg, options);
+}
+
+// FWBW with a pivot strategy other than the default
+template <FWBWPivot kPivot>
+int runFWBWPivot(const CSRGraph &graph, LoopStructureGraph *lsg, ThreadPool *pool,
+                 LoopAnalysisWorkspace *workspace) {
+    FWBWOptions options;
+    options.pool = pool;
+    options.workspace = workspace;
+    options.pivot = kPivot;
+    return FindFWBWLoops(graph, lsg, options);
+}
+
+int runMultistep(const CSRGraph &graph, LoopStructureGraph *lsg, ThreadPool *pool,
+                 LoopAnalysisWorkspace *workspace) {
+    MultistepOptions options;
+    options.pool = pool;
+    options.workspace = workspace;
+    return FindMultistepLoops(graph, lsg, options);
+}
+
+// keeps the closure, as a caller that queries it afterwards would
+int runClosure(const CSRGraph &graph, LoopStructureGraph *lsg, ThreadPool *,
+               LoopAnalysisWorkspace *workspace) {
+    ReachabilityClosure closure;
+    ClosureOptions options;
+    options.workspace = workspace;
+    options.closure = &closure;
+    return FindClosureLoops(graph, lsg, options);
+}
+
+const char *closurePath(const CSRGraph &graph) {
+    return FitsClosureMatrix(graph) ? "matrix" : "tarjan";
+}
+
+const BenchmarkEngine kBenchmarkEngines[] = {
+    {"havlak", runHavlak, nullptr},
+    {"small", runSmall, smallPath},
+    {"fast-havlak", runFastHavlak, nullptr},
+    {"parallel-havlak", runParallelHavlak, nullptr},
+    {"tarjan", runTarjan, nullptr},
+    {"fwbw", runFWBW, nullptr},
+    {"fwbw-first", runFWBWPivot<kPivotFirst>, nullptr},
+    {"fwbw-degree", runFWBWPivot<kPivotDegree>, nullptr},
+    {"fwbw-sampled", runFWBWPivot<kPivotSampled>, nullptr},
+    {"multistep", runMultistep, nullptr},
+    {"closure", runClosure, closurePath},
+};
+
+// width of the engine column in the text output: the longest name
+int engineColumnWidth() {
+    size_t width = strlen("engine");
+    for (const BenchmarkEngine &engine : kBenchmarkEngines)
+        width = max(width, strlen(engine.name));
+    return (int)width;
+}
+
+// a CFG generator the benchmark can select, parameterized by one size
+struct BenchmarkGraph {
+    const char *name;
+    const char *size_meaning;
+    int default_size;
+    void (*build)(MaoCFG *cfg, int size);
+    int check_size;  // size the forest check builds it at
+};
+
+void buildSimpleGraph(MaoCFG *cfg, int) {
+    buildSimpleCFG(cfg);
+}
+
+void buildComplexGraph(MaoCFG *cfg, int trees) {
+    buildSimpleCFG(cfg);
+    addLoopTrees(cfg, trees);
+}
+
+void buildScalableGraph(MaoCFG *cfg, int sccs) {
+    buildScalableSCCs(cfg, sccs);
+}
+
+void buildChainGraph(MaoCFG *cfg, int length) {
+    cfg->CreateNode(0);
+    buildStraight(cfg, 0, length);
+}
+
+void buildLoopBodyGraph(MaoCFG *cfg, int diamonds) {
+    cfg->CreateNode(0);
+    buildLargeLoopBody(cfg, 0, diamonds);
+}
+
+void buildNestedGraph(MaoCFG *cfg, int depth) {
+    cfg->CreateNode(0);
+    buildDeepNest(cfg, 0, depth);
+}
+
+const BenchmarkGraph kBenchmarkGraphs[] = {
+    {"simple", "ignored", 1, buildSimpleGraph, 1},
+    {"complex", "parallel loop trees", 10, buildComplexGraph, 2},
+    {"scalable", "SCCs", 2048, buildScalableGraph, 512},
+    {"chain", "blocks", 100000, buildChainGraph, 10000},
+    {"loopbody", "diamonds in the loop", 10000, buildLoopBodyGraph, 1000},
+    {"nested", "nesting depth", 1000, buildNestedGraph, 200},
+};
+
+struct BenchmarkOptions {
+    vector<const BenchmarkEngine *> engines;
+    vector<const BenchmarkGraph *> graphs;
+    vector<int> sizes;  // empty: each graph's default size
+    int iterations = 10;
+    int warmup = 1;
+    int threads = 0;    // 0: ThreadPool::Default()
+    bool workspace = false;
+    bool json = false;
+};
+
+// summary of the per-iteration times of one configuration, in ms
+struct TimingStats {
+    double min, max, mean, stddev;
+    double median, p90, p99;
+};
+
+// nearest-rank percentile of sorted samples
+double percentile(const vector<double> &sorted, double p) {
+    size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+TimingStats computeStats(vector<double> samples) {
+    TimingStats stats;
+    sort(samples.begin(), samples.end());
+
+    double sum = 0;
+    for (double s : samples)
+        sum += s;
+    stats.mean = sum / samples.size();
+
+    double squares = 0;
+    for (double s : samples)
+        squares += (s - stats.mean) * (s - stats.mean);
+    stats.stddev = sqrt(squares / samples.size());
+
+    stats.min = samples.front();
+    stats.max = samples.back();
+    stats.median = percentile(samples, 50);
+    stats.p90 = percentile(samples, 90);
+    stats.p99 = percentile(samples, 99);
+    return stats;
+}
+
+void printUsage() {
+    fprintf(stderr,
+            "usage: a.out                 run the default test suite\n"
+            "       a.out [options]       run the benchmark\n"
+            "       a.out --help          print this message\n"
+            "\n"
+            "options:\n"
+            "  --engine=E[,E...]   loop finders, or 'all' (default: all)\n"
+            "  --graph=G[,G...]    CFG generators, or 'all' (default: scalable)\n"
+            "  --size=N[,N...]     generator sizes (default: per generator)\n"
+            "  --iterations=N      timed runs per configuration (default: 10)\n"
+            "  --warmup=N          untimed runs before those (default: 1)\n"
+            "  --threads=N         threads for parallel engines, counting the\n"
+            "                      caller (default: 0, one per CPU)\n"
+            "  --workspace         reuse one scratch workspace and loop graph\n"
+            "                      for all runs\n"
+            "  --json              print results as JSON\n"
+            "\n"
+            "engines:");
+    for (const BenchmarkEngine &engine : kBenchmarkEngines)
+        fprintf(stderr, " %s", engine.name);
+    fprintf(stderr, "\ngraphs:\n");
+    for (const BenchmarkGraph &graph : kBenchmarkGraphs)
+        fprintf(stderr, "  %-10s size is %s (default: %d)\n",
+                graph.name, graph.size_meaning, graph.default_size);
+}
+
+// split a comma separated list
+vector<string> splitList(const char *list) {
+    vector<string> items;
+    string item;
+    for (const char *p = list;; ++p) {
+        if (*p == ',' || *p == '\0') {
+            if (!item.empty())
+                items.push_back(item);
+            item.clear();
+            if (*p == '\0')
+                break;
+        } else {
+            item += *p;
+        }
+    }
+    return items;
+}
+
+// parse a non-negative integer, return false on garbage
+bool parseCount(const char *text, int *value) {
+    char *end;
+    long v = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || v < 0 || v > 1000000000)
+        return false;
+    *value = (int)v;
+    return true;
+}
+
+template <typename T, size_t N>
+bool selectByName(const T (&table)[N], const char *list, vector<const T *> *out) {
+    for (const string &name : splitList(list)) {
+        if (name == "all") {
+            for (const T &entry : table)
+                out->push_back(&entry);
+            continue;
+        }
+        const T *found = NULL;
+        for (const T &entry : table)
+            if (name == entry.name)
+                found = &entry;
+        if (!found) {
+            fprintf(stderr, "unknown name: %s\n", name.c_str());
+            return false;
+        }
+        out->push_back(found);
+    }
+    return !out->empty();
+}
+
+// parse the command line, return false after printing why it is invalid
+bool parseBenchmarkOptions(int argc, char *argv[], BenchmarkOptions *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = strchr(arg, '=');
+        value = value ? value + 1 : "";
+
+        bool ok = true;
+        if (!strcmp(arg, "--help")) {
+            printUsage();
+            exit(0);
+        } else if (!strncmp(arg, "--engine=", 9)) {
+            ok = selectByName(kBenchmarkEngines, value, &options->engines);
+        } else if (!strncmp(arg, "--graph=", 8)) {
+            ok = selectByName(kBenchmarkGraphs, value, &options->graphs);
+        } else if (!strncmp(arg, "--size=", 7)) {
+            for (const string &item : splitList(value)) {
+                int size;
+                ok = ok && parseCount(item.c_str(), &size);
+                options->sizes.push_back(size);
+            }
+            ok = ok && !options->sizes.empty();
+        } else if (!strncmp(arg, "--iterations=", 13)) {
+            ok = parseCount(value, &options->iterations) &&
+                 options->iterations > 0;
+        } else if (!strncmp(arg, "--warmup=", 9)) {
+            ok = parseCount(value, &options->warmup);
+        } else if (!strncmp(arg, "--threads=", 10)) {
+            ok = parseCount(value, &options->threads);
+        } else if (!strcmp(arg, "--workspace")) {
+            options->workspace = true;
+        } else if (!strcmp(arg, "--json")) {
+            options->json = true;
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "invalid argument: %s\n\n", arg);
+            printUsage();
+            return false;
+        }
+    }
+
+    if (options->engines.empty())
+        selectByName(kBenchmarkEngines, "all", &options->engines);
+    if (options->graphs.empty())
+        selectByName(kBenchmarkGraphs, "scalable", &options->graphs);
+    return true;
+}
+
+// time one engine on one graph, then print the result
+void runBenchmarkConfig(const BenchmarkOptions &options,
+                        const BenchmarkGraph &generator, int size,
+                        const CSRGraph &graph, const BenchmarkEngine &engine,
+                        ThreadPool *pool, bool first) {
+    // warmup runs size the workspace and the reused loop graph for the
+    // timed ones
+    unique_ptr<LoopAnalysisWorkspace> workspace;
+    if (options.workspace)
+        workspace.reset(new LoopAnalysisWorkspace());
+    LoopStructureGraph reused;
+
+    for (int i = 0; i < options.warmup; i++) {
+        LoopStructureGraph fresh;
+        LoopStructureGraph *lsg = workspace ? &reused : &fresh;
+        lsg->Clear();
+        engine.find(graph, lsg, pool, workspace.get());
+    }
+
+    vector<double> samples;
+    int loops = 0;
+    pool->ResetStats();
+    for (int i = 0; i < options.iterations; i++) {
+        LoopStructureGraph fresh;
+        LoopStructureGraph *lsg = workspace ? &reused : &fresh;
+        auto start = chrono::high_resolution_clock::now();
+        lsg->Clear();
+        loops = engine.find(graph, lsg, pool, workspace.get());
+        auto end = chrono::high_resolution_clock::now();
+        samples.push_back(chrono::duration<double, milli>(end - start).count());
+    }
+    TimingStats stats = computeStats(samples);
+
+    // pool activity per iteration
+    ThreadPool::Stats poolStats = pool->GetStats();
+    double tasks = (double)poolStats.tasks / options.iterations;
+    double steals = (double)poolStats.steals / options.iterations;
+    double idle = (double)poolStats.idle / options.iterations;
+    const char *path = engine.path ? engine.path(graph) : "-";
+
+    if (options.json) {
+        printf("%s\n  {\"engine\": \"%s\", \"graph\": \"%s\", \"size\": %d, "
+               "\"nodes\": %d, \"edges\": %zu, \"threads\": %d, "
+               "\"warmup\": %d, \"iterations\": %d, \"loops\": %d, "
+               "\"min_ms\": %.6f, \"median_ms\": %.6f, \"p90_ms\": %.6f, "
+               "\"p99_ms\": %.6f, \"max_ms\": %.6f, \"mean_ms\": %.6f, "
+               "\"stddev_ms\": %.6f, \"tasks\": %.1f, \"steals\": %.1f, "
+               "\"idle\": %.1f, \"path\": \"%s\"}",
+               first ? "" : ",", engine.name, generator.name, size,
+               graph.GetNumNodes(), graph.GetNumEdges(),
+               pool->num_workers() + 1, options.warmup, options.iterations,
+               loops, stats.min, stats.median, stats.p90, stats.p99,
+               stats.max, stats.mean, stats.stddev, tasks, steals, idle, path);
+    } else {
+        printf("%-*s %-9s %9d %9d %8d %11.3f %11.3f %11.3f %11.3f "
+               "%8.0f %8.0f %8.0f  %s\n",
+               engineColumnWidth(), engine.name, generator.name, size, graph.GetNumNodes(), loops,
+               stats.median, stats.p90, stats.p99, stats.stddev,
+               tasks, steals, idle, path);
+    }
+    fflush(stdout);
+}
+
+// benchmark every selected engine on every selected graph and size
+int runBenchmark(int argc, char *argv[]) {
+    BenchmarkOptions options;
+    if (!parseBenchmarkOptions(argc, argv, &options))
+        return 1;
+
+    if (options.json)
+        printf("[");
+    else
+        printf("%-*s %-9s %9s %9s %8s %11s %11s %11s %11s %8s %8s %8s  %s\n",
+               engineColumnWidth(), "engine", "graph", "size", "nodes", "loops", "median_ms",
+               "p90_ms", "p99_ms", "stddev_ms", "tasks", "steals", "idle", "path");
+
+    // the caller helps out in TaskGroup::Wait(), so it counts as a thread
+    unique_ptr<ThreadPool> ownPool;
+    if (options.threads > 0)
+        ownPool.reset(new ThreadPool(options.threads - 1));
+    ThreadPool *pool = ownPool ? ownPool.get() : ThreadPool::Default();
+
+    bool first = true;
+    for (const BenchmarkGraph *generator : options.graphs) {
+        vector<int> sizes = options.sizes;
+        if (sizes.empty())
+            sizes.push_back(generator->default_size);
+
+        for (int size : sizes) {
+            MaoCFG cfg;
+            generator->build(&cfg, size);
+            CSRGraph graph;
+            cfg.BuildSnapshot(&graph);
+
+            for (const BenchmarkEngine *engine : options.engines) {
+                runBenchmarkConfig(options, *generator, size, graph, *engine,
+                                   pool, first);
+                first = false;
+            }
+        }
+    }
+
+    if (options.json)
+        printf("\n]\n");
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////FOREST CHECK//////////////////////////////////////
+
+// a loop as the forest check compares it: by block names, with the
+// blocks sorted
+struct LoopShape {
+    int parent;  // header of the enclosing loop, or -1
+    vector<int> blocks;
+
+    bool operator==(const LoopShape &other) const {
+        return parent == other.parent && blocks == other.blocks;
+    }
+};
+
+// The loops of 'lsg' by header name, leaving out the blocks the start
+// block does not reach: FWBW and Multistep find loops among those,
+// which Havlak's algorithm never visits.
+map<int, LoopShape> forestShape(const CSRGraph &graph, LoopStructureGraph *lsg) {
+    set<int> live;
+    if (graph.start_node() != CSRGraph::kNoNode) {
+        vector<CSRGraph::NodeId> stack(1, graph.start_node());
+        live.insert(graph.block(graph.start_node())->name());
+        while (!stack.empty()) {
+            CSRGraph::NodeId id = stack.back();
+            stack.pop_back();
+            for (CSRGraph::NodeId succ : graph.out_edges(id)) {
+                if (live.insert(graph.block(succ)->name()).second)
+                    stack.push_back(succ);
+            }
+        }
+    }
+
+    map<int, LoopShape> shape;
+    for (SimpleLoop *loop : lsg->GetLoops()) {
+        if (loop == lsg->root() || !loop->header() || !live.count(loop->header()->name()))
+            continue;
+
+        LoopShape &entry = shape[loop->header()->name()];
+        SimpleLoop *parent = loop->parent();
+        entry.parent = parent && parent != lsg->root() && parent->header()
+                           ? parent->header()->name() : -1;
+        for (BasicBlock *block : loop->GetBasicBlocks()) {
+            if (live.count(block->name()))
+                entry.blocks.push_back(block->name());
+        }
+        sort(entry.blocks.begin(), entry.blocks.end());
+    }
+    return shape;
+}
+
+// Run every benchmark engine on 'cfg', on each pool, and compare its
+// forest with Havlak's. The reference runs Havlak's finder itself,
+// whatever the size of the graph, so the "small" engine is checked
+// against it rather than the other way round. Returns the number of
+// runs that disagree.
+int checkForests(const char *name, MaoCFG *cfg, const vector<ThreadPool *> &pools) {
+    CSRGraph graph;
+    cfg->BuildSnapshot(&graph);
+    LoopStructureGraph reference;
+    FindHavlakLoopsIn(graph, &reference);
+    reference.CalculateNestingLevel();
+    map<int, LoopShape> expected = forestShape(graph, &reference);
+
+    int mismatches = 0;
+    for (const BenchmarkEngine &engine : kBenchmarkEngines) {
+        for (ThreadPool *pool : pools) {
+            LoopStructureGraph lsg;
+            engine.find(graph, &lsg, pool, nullptr);
+            lsg.CalculateNestingLevel();
+            map<int, LoopShape> found = forestShape(graph, &lsg);
+            if (found == expected)
+                continue;
+
+            // report the first loop that differs
+            auto want = expected.begin();
+            auto got = found.begin();
+            while (want != expected.end() && got != found.end() &&
+                   want->first == got->first && want->second == got->second) {
+                ++want;
+                ++got;
+            }
+            int header = want == expected.end() ? got->first
+                         : got == found.end() ? want->first
+                                              : min(want->first, got->first);
+            fprintf(stderr, "MISMATCH: %s on %s with %d workers: %zu loops, "
+                    "Havlak %zu; they differ at the loop headed by %d\n",
+                    engine.name, name, pool->num_workers(), found.size(),
+                    expected.size(), header);
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+// Every engine has to build Havlak's forest: on each benchmark graph,
+// and on random irreducible ones with and without dead blocks. Each
+// runs on the default pool and on one with workers, which takes the
+// parallel paths even on a single CPU.
+int runForestChecks() {
+    fprintf(stderr, "\n=== Checking Loop Forests against Havlak ===\n");
+
+    const int kRandomGraphs = 50;
+    ThreadPool workers(3);
+    vector<ThreadPool *> pools = {ThreadPool::Default(), &workers};
+
+    int mismatches = 0;
+    for (const BenchmarkGraph &generator : kBenchmarkGraphs) {
+        MaoCFG cfg;
+        generator.build(&cfg, generator.check_size);
+        mismatches += checkForests(generator.name, &cfg, pools);
+    }
+
+    for (int seed = 1; seed <= kRandomGraphs; seed++) {
+        for (int deadBlocks : {0, seed % 8 + 2}) {
+            MaoCFG cfg;
+            buildRandomGraph(&cfg, seed, 8 + 5 * seed, deadBlocks);
+            char name[64];
+            snprintf(name, sizeof(name), "random graph %d, %d dead blocks", seed, deadBlocks);
+            mismatches += checkForests(name, &cfg, pools);
+        }
+    }
+
+    fprintf(stderr, "%zu engines on %zu graphs and %d random ones: %d mismatches\n",
+            sizeof(kBenchmarkEngines) / sizeof(kBenchmarkEngines[0]),
+            sizeof(kBenchmarkGraphs) / sizeof(kBenchmarkGraphs[0]), 2 * kRandomGraphs,
+            mismatches);
+    return mismatches;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////MAIN FUNCTION BELOW//////////////////////////////////
 
 int main(int argc, char *argv[]) {
+    if (argc > 1)
+        return runBenchmark(argc, argv);
+
     fprintf(stderr, "Welcome to LoopTesterApp, C++ edition\n");
     fprintf(stderr, "Constructing cfg...\n");
     MaoCFG cfg;
@@ -265,71 +1146,72 @@ int main(int argc, char *argv[]) {
     LoopStructureGraph lsg;
 
     fprintf(stderr, "Constructing Simple CFG...\n");
-    cfg.CreateNode(0); // top
-    buildBaseLoop(&cfg, 0);
-    cfg.CreateNode(1); // bottom
-    new BasicBlockEdge(&cfg, 0, 2);
+    buildSimpleCFG(&cfg);
+
+    // =========== DUMMY LOOPS TEST FOR ALL ALGORITHMS ===========
+    fprintf(stderr, "15000 dummy loops for all algorithms\n");
 
-    // =========== DUMMY LOOPS TEST FOR BOTH ALGORITHMS ===========
-    fprintf(stderr, "15000 dummy loops for both algorithms\n");
+    // one workspace recycles the snapshot and scratch of all calls, and
+    // one loop graph is cleared and refilled by each of them
+    LoopAnalysisWorkspace workspace;
+    FWBWOptions fwbw_options;
+    fwbw_options.workspace = &workspace;
+    LoopStructureGraph lsglocal;
+
+    auto havlak_start = chrono::high_resolution_clock::now();
+    for (int dummyloops = 0; dummyloops < 15000; ++dummyloops) {
+        lsglocal.Clear();
+        FindHavlakLoops(workspace.Snapshot(&cfg), &lsglocal, &workspace);
+    }
+    auto havlak_end = chrono::high_resolution_clock::now();
 
-    vector<LoopStructureGraph *> to_delete;
     auto fwbw_start = chrono::high_resolution_clock::now();
     for (int dummyloops = 0; dummyloops < 15000; ++dummyloops) {
-        LoopStructureGraph *lsglocal = new LoopStructureGraph();
-        FindFWBWLoops(&cfg, lsglocal);
-        to_delete.push_back(lsglocal);
+        lsglocal.Clear();
+        FindFWBWLoops(workspace.Snapshot(&cfg), &lsglocal, fwbw_options);
     }
     auto fwbw_end = chrono::high_resolution_clock::now();
 
     auto tarjan_start = chrono::high_resolution_clock::now();
     for (int dummyloops = 0; dummyloops < 15000; ++dummyloops) {
-        LoopStructureGraph *lsglocal = new LoopStructureGraph();
-        FindTarjanLoops(&cfg, lsglocal);
-        to_delete.push_back(lsglocal);
+        lsglocal.Clear();
+        FindTarjanLoops(workspace.Snapshot(&cfg), &lsglocal, &workspace);
     }
     auto tarjan_end = chrono::high_resolution_clock::now();
 
-    // clean up!
-    for (auto p : to_delete) {
-        delete (p);
+    // the bit-parallel finder FindLoopsAuto() picks for a CFG this small
+    auto small_start = chrono::high_resolution_clock::now();
+    for (int dummyloops = 0; dummyloops < 15000; ++dummyloops) {
+        lsglocal.Clear();
+        FindLoopsAuto(&cfg, &lsglocal);
     }
+    auto small_end = chrono::high_resolution_clock::now();
 
     // Print timing comparison
+    chrono::duration<double, milli> havlak_duration = havlak_end - havlak_start;
     chrono::duration<double, milli> fwbw_duration = fwbw_end - fwbw_start;
     chrono::duration<double, milli> tarjan_duration = tarjan_end - tarjan_start;
+    chrono::duration<double, milli> small_duration = small_end - small_start;
 
     fprintf(stderr, "Dummy loop times per iteration:\n");
+    fprintf(stderr, "  Havlak: %f milliseconds\n", havlak_duration.count() / 15000);
     fprintf(stderr, "  FWBW:   %f milliseconds\n", fwbw_duration.count() / 15000);
     fprintf(stderr, "  Tarjan: %f milliseconds\n", tarjan_duration.count() / 15000);
+    fprintf(stderr, "  Small:  %f milliseconds\n", small_duration.count() / 15000);
 
     // =========== BUILD COMPLEX CFG ===========
     fprintf(stderr, "Constructing complex CFG...\n");
-    int n = 2;
+    addLoopTrees(&cfg, 10);
 
-    for (int parlooptrees = 0; parlooptrees < 10; parlooptrees++) {
-        cfg.CreateNode(n + 1);
-        buildConnect(&cfg, 2, n + 1);
-        n = n + 1;
-
-        for (int i = 0; i < 100; i++) {
-            int top = n;
-            n = buildStraight(&cfg, n, 1);
-            for (int j = 0; j < 25; j++) {
-                n = buildBaseLoop(&cfg, n);
-            }
-            int bottom = buildStraight(&cfg, n, 1);
-            buildConnect(&cfg, n, top);
-            n = bottom;
-        }
-        buildConnect(&cfg, n, 1);
-    }
-
-    // =========== SINGLE ITERATION TEST FOR BOTH ALGORITHMS ===========
-    fprintf(stderr, "Performing Loop Recognition\n1 Iteration with both algorithms\n");
+    // =========== SINGLE ITERATION TEST FOR ALL ALGORITHMS ===========
+    fprintf(stderr, "Performing Loop Recognition\n1 Iteration with all algorithms\n");
 
     // test each algorithm for a single iteration
-    LoopStructureGraph lsg_fwbw, lsg_tarjan;
+    LoopStructureGraph lsg_havlak, lsg_fwbw, lsg_tarjan;
+
+    auto single_havlak_start = chrono::high_resolution_clock::now();
+    int num_loops_havlak = FindHavlakLoops(&cfg, &lsg_havlak);
+    auto single_havlak_end = chrono::high_resolution_clock::now();
 
     auto single_fwbw_start = chrono::high_resolution_clock::now();
     int num_loops_fwbw = FindFWBWLoops(&cfg, &lsg_fwbw);
@@ -340,6 +1222,9 @@ int main(int argc, char *argv[]) {
     auto single_tarjan_end = chrono::high_resolution_clock::now();
 
     fprintf(stderr, "Single iteration times:\n");
+    fprintf(stderr, "  Havlak: %f milliseconds, found %d loops\n",
+            chrono::duration<double, milli>(single_havlak_end - single_havlak_start).count(),
+            num_loops_havlak);
     fprintf(stderr, "  FWBW:   %f milliseconds, found %d loops\n",
             chrono::duration<double, milli>(single_fwbw_end - single_fwbw_start).count(),
             num_loops_fwbw);
@@ -387,6 +1272,9 @@ int main(int argc, char *argv[]) {
 
     // =========== SCALING TESTS ===========
     runScalingSCCTests();
+    runClosureBandTests();
+    runDeepChainTests();
+    runLargeLoopBodyTests();
     // =========== COMPARISON TESTS ===========
     // compareAllAlgorithms(32);
     // compareAllAlgorithms(512);
@@ -394,5 +1282,9 @@ int main(int argc, char *argv[]) {
     // compareAllAlgorithms(8192);
     // compareAllAlgorithms(16384);
 
+    // =========== FOREST CHECK ===========
+    if (runForestChecks())
+        return 1;
+
     return 0;
 }
@@ -0,0 +1,74 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Arena
+//
+// Bump allocator that carves objects out of a few large chunks, so
+// objects allocated together are contiguous and teardown is one free()
+// per chunk instead of one delete per object. Chunk sizes double up to
+// kMaxChunkSize.
+//
+// The arena never runs destructors. Owners placing objects with
+// non-trivial destructors must destroy them before the arena goes away.
+//
+class Arena {
+public:
+    static const size_t kMaxChunkSize = 1 << 20;
+
+    explicit Arena(size_t first_chunk_size = 4096)
+        : ptr_(NULL), limit_(NULL), next_chunk_size_(first_chunk_size) {
+    }
+
+    ~Arena() {
+        for (size_t i = 0; i < chunks_.size(); ++i)
+            free(chunks_[i]);
+    }
+
+    void *Allocate(size_t size, size_t align) {
+        uintptr_t p = (reinterpret_cast<uintptr_t>(ptr_) + align - 1) & ~(align - 1);
+        if (!ptr_ || p + size > reinterpret_cast<uintptr_t>(limit_)) {
+            NewChunk(size + align);
+            p = (reinterpret_cast<uintptr_t>(ptr_) + align - 1) & ~(align - 1);
+        }
+        ptr_ = reinterpret_cast<char *>(p + size);
+        return reinterpret_cast<void *>(p);
+    }
+
+    template <typename T, typename... Args>
+    T *New(Args &&...args) {
+        return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+private:
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+
+    void NewChunk(size_t min_size) {
+        size_t size = next_chunk_size_;
+        while (size < min_size)
+            size *= 2;
+        if (next_chunk_size_ < kMaxChunkSize)
+            next_chunk_size_ *= 2;
+
+        char *chunk = static_cast<char *>(malloc(size));
+        if (!chunk)
+            throw std::bad_alloc();
+        chunks_.push_back(chunk);
+        ptr_ = chunk;
+        limit_ = chunk + size;
+    }
+
+    std::vector<char *> chunks_;
+    char *ptr_;               // next free byte in the current chunk
+    char *limit_;             // end of the current chunk
+    size_t next_chunk_size_;
+};
+
+#endif // ARENA_H_
@@ -0,0 +1,53 @@
+#ifndef ATOMIC_BITMAP_H_
+#define ATOMIC_BITMAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory_resource>
+
+#include "scratch-array.h"
+
+// AtomicBitmap
+//
+// One bit per dense index, 64 to a word, that several threads may set
+// and clear at the same time. TestAndSet() tells the one thread that
+// flipped a bit apart from all others, which makes the bitmap a visited
+// set for parallel traversals. All operations are relaxed: they order
+// nothing but the bit itself.
+//
+class AtomicBitmap {
+public:
+    explicit AtomicBitmap(std::pmr::memory_resource *memory =
+                              std::pmr::get_default_resource())
+        : words_(memory) {
+    }
+
+    // Make room for 'size' bits, all clear.
+    void Reset(size_t size) {
+        words_.Reset((size + 63) / 64);
+    }
+
+    bool Get(size_t i) const {
+        return words_[i / 64].load(std::memory_order_relaxed) & Mask(i);
+    }
+
+    // Set bit i, return whether this call was the one that set it.
+    bool TestAndSet(size_t i) {
+        uint64_t mask = Mask(i);
+        if (words_[i / 64].load(std::memory_order_relaxed) & mask)
+            return false;  // cheap early out, no write
+        return !(words_[i / 64].fetch_or(mask, std::memory_order_relaxed) & mask);
+    }
+
+    void Clear(size_t i) {
+        words_[i / 64].fetch_and(~Mask(i), std::memory_order_relaxed);
+    }
+
+private:
+    static uint64_t Mask(size_t i) { return uint64_t(1) << (i % 64); }
+
+    ScratchArray<std::atomic<uint64_t> > words_;
+};
+
+#endif // ATOMIC_BITMAP_H_
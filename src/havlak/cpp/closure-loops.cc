@@ -0,0 +1,237 @@
+#include <memory_resource>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CLOSURE_X86_KERNELS 1
+#endif
+
+#include "closure-loops.h"
+#include "loop-workspace.h"
+#include "mao-loops.h"
+#include "tarjan-loops-inl.h"
+#include "tarjan-loops.h"
+
+// The row kernels: dst |= src over 'words' words. Rows are padded to a
+// multiple of 8 words, so the vector versions need no tail. The scalar
+// one is what the compiler makes of a plain loop for the target it was
+// built for; the others are compiled for their extension only, and
+// picked at run time.
+typedef void (*RowOr)(uint64_t *dst, const uint64_t *src, size_t words);
+
+static void OrRowScalar(uint64_t *dst, const uint64_t *src, size_t words) {
+    for (size_t i = 0; i < words; ++i)
+        dst[i] |= src[i];
+}
+
+#ifdef CLOSURE_X86_KERNELS
+__attribute__((target("avx2")))
+static void OrRowAVX2(uint64_t *dst, const uint64_t *src, size_t words) {
+    for (size_t i = 0; i < words; i += 4) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_or_si256(a, b));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void OrRowAVX512(uint64_t *dst, const uint64_t *src, size_t words) {
+    for (size_t i = 0; i < words; i += 8) {
+        __m512i a = _mm512_loadu_si512(dst + i);
+        __m512i b = _mm512_loadu_si512(src + i);
+        _mm512_storeu_si512(dst + i, _mm512_or_si512(a, b));
+    }
+}
+#endif
+
+ClosureKernel ResolveClosureKernel(ClosureKernel kernel) {
+#ifdef CLOSURE_X86_KERNELS
+    __builtin_cpu_init();
+    bool avx512 = __builtin_cpu_supports("avx512f");
+    bool avx2 = __builtin_cpu_supports("avx2");
+#else
+    bool avx512 = false;
+    bool avx2 = false;
+#endif
+    if (kernel == kClosureAuto || kernel == kClosureAVX512) {
+        if (avx512)
+            return kClosureAVX512;
+        kernel = kClosureAVX2;
+    }
+    if (kernel == kClosureAVX2 && avx2)
+        return kClosureAVX2;
+    return kClosureScalar;
+}
+
+const char *ClosureKernelName(ClosureKernel kernel) {
+    switch (kernel) {
+    case kClosureAuto:
+        return "auto";
+    case kClosureScalar:
+        return "scalar";
+    case kClosureAVX2:
+        return "avx2";
+    case kClosureAVX512:
+        return "avx512";
+    }
+    return "unknown";
+}
+
+static RowOr RowOrFor(ClosureKernel kernel) {
+    switch (ResolveClosureKernel(kernel)) {
+#ifdef CLOSURE_X86_KERNELS
+    case kClosureAVX512:
+        return OrRowAVX512;
+    case kClosureAVX2:
+        return OrRowAVX2;
+#endif
+    default:
+        return OrRowScalar;
+    }
+}
+
+void ReachabilityClosure::Clear() {
+    num_nodes_ = 0;
+    words_ = 0;
+    rows_.clear();
+    component_.clear();
+    header_of_.clear();
+    parent_of_.clear();
+}
+
+bool ReachabilityClosure::IsBackEdge(NodeId from, NodeId to) const {
+    if (header_of_[to] != to)
+        return false;
+    for (NodeId header = header_of_[from]; header != CSRGraph::kNoNode;
+         header = parent_of_[header]) {
+        if (header == to)
+            return true;
+    }
+    return false;
+}
+
+// Hooks of Tarjan's loop finder (tarjan-loops-inl.h) that build the
+// transitive closure of the graph as it searches
+//
+// The closure is Purdom's: the search for the outermost SCCs (see
+// pearce-scc.h) hands them over sinks first, so the rows of the SCCs an
+// SCC has edges into are complete by the time it comes up, and its own
+// row is those rows or'ed together, plus the targets of the edges. That
+// is one row OR, over all n / 64 words, per pair of SCCs joined by an
+// edge; the vector kernels above do them. Iterating the rows to a fixed
+// point instead takes as many passes over the edges as loops nest, and
+// Warshall's algorithm n^3 / 64 word operations on any graph. The SCCs
+// thus come from the search, not from rows and columns of the closure:
+// that order is what builds each row once. Finding the loops costs what
+// Tarjan's engine does plus the rows, which pay off in the queries
+// answered from them afterwards.
+//
+// The loops are Tarjan's: the outermost loops are the SCCs searched
+// from the start node, each headed by its first node entered, the
+// nested ones the SCCs of each body without its header, at the same
+// cost on deep nesting. Nodes the start node does not reach are
+// searched last, for the closure only.
+class ClosureHooks {
+public:
+    typedef CSRGraph::NodeId NodeId;
+
+    // 'stamp' is scratch for the rows or'ed in
+    ClosureHooks(const CSRGraph &graph, ReachabilityClosure *closure, ClosureKernel kernel,
+                 std::pmr::vector<NodeId> *stamp)
+        : graph_(&graph), closure_(closure), or_row_(RowOrFor(kernel)), stamp_(stamp) {}
+
+    // size the closure for the graph, no row yet
+    void StartClosure() {
+        ReachabilityClosure &closure = *closure_;
+        NodeId size = graph_->GetNumNodes();
+        closure.num_nodes_ = size;
+        closure.words_ = (size + 511) / 512 * 8;
+        closure.rows_.clear();
+        closure.rows_.reserve(size * closure.words_);
+        closure.component_.assign(size, CSRGraph::kNoNode);
+        closure.header_of_.assign(size, CSRGraph::kNoNode);
+        closure.parent_of_.assign(size, CSRGraph::kNoNode);
+        stamp_->assign(size, CSRGraph::kNoNode);
+    }
+
+    bool SearchUnreached() const { return true; }
+
+    // Give the outermost SCC [first, last) its row. The SCCs of the
+    // targets of its edges have theirs, but for itself; stamp_ keeps
+    // each one from being or'ed in twice.
+    void Component(const NodeId *first, const NodeId *last) {
+        ReachabilityClosure &closure = *closure_;
+        std::pmr::vector<NodeId> &stamp = *stamp_;
+        size_t words = closure.words_;
+        NodeId component = closure.rows_.size() / words;
+        for (const NodeId *node = first; node != last; ++node)
+            closure.component_[*node] = component;
+
+        closure.rows_.resize((component + 1) * words);
+        uint64_t *row = &closure.rows_[component * words];
+        for (const NodeId *node = first; node != last; ++node) {
+            for (NodeId succ : graph_->out_edges(*node)) {
+                row[succ >> 6] |= uint64_t(1) << (succ & 63);
+                NodeId other = closure.component_[succ];
+                if (other == component || stamp[other] == component)
+                    continue;
+                stamp[other] = component;
+                or_row_(row, &closure.rows_[other * words], words);
+            }
+        }
+    }
+
+    void Loop(NodeId header, NodeId parent) {
+        closure_->header_of_[header] = header;
+        closure_->parent_of_[header] = parent;
+    }
+
+    void Block(NodeId node, NodeId header) {
+        closure_->header_of_[node] = header;
+    }
+
+private:
+    const CSRGraph *graph_;              // the control flow graph
+    ReachabilityClosure *closure_;       // closure to fill
+    RowOr or_row_;                       // its row kernel
+    std::pmr::vector<NodeId> *stamp_;    // last row each row was or'ed into
+};
+
+int FindClosureLoops(MaoCFG *CFG, LoopStructureGraph *LSG) {
+    CSRGraph graph;
+    CFG->BuildSnapshot(&graph);
+    return FindClosureLoops(graph, LSG);
+}
+
+int FindClosureLoops(const CSRGraph &graph, LoopStructureGraph *LSG) {
+    return FindClosureLoops(graph, LSG, ClosureOptions());
+}
+
+int FindClosureLoops(const CSRGraph &graph, LoopStructureGraph *LSG,
+                     const ClosureOptions &options) {
+    // no room for the matrix
+    if (!FitsClosureMatrix(graph)) {
+        if (options.closure)
+            options.closure->Clear();
+        return FindTarjanLoops(graph, LSG, options.workspace);
+    }
+
+    // no closure to keep: the loops are Tarjan's
+    if (!options.closure)
+        return FindTarjanLoops(graph, LSG, options.workspace);
+
+    std::pmr::memory_resource *memory = BeginScratch(options.workspace);
+    std::pmr::vector<CSRGraph::NodeId> stamp(memory);
+    ClosureHooks hooks(graph, options.closure, options.kernel, &stamp);
+    hooks.StartClosure();
+
+    TarjanLoopFinder<CSRGraph, ClosureHooks> finder(graph, LSG, memory, hooks);
+    finder.FindLoops();
+    return LSG->GetNumLoops();
+}
+
+bool FitsClosureMatrix(const CSRGraph &graph) {
+    return graph.GetNumNodes() <= (CSRGraph::NodeId)kMaxClosureNodes;
+}
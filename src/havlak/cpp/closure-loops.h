@@ -0,0 +1,116 @@
+#ifndef CLOSURE_LOOPS_H_
+#define CLOSURE_LOOPS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "mao-loops.h"
+
+// forward declaration of the hooks of Tarjan's loop finder that build
+// the closure
+class ClosureHooks;
+
+// largest graph FindClosureLoops() builds the reachability matrix for;
+// its rows take up to kMaxClosureNodes^2 / 8 bytes
+static const int kMaxClosureNodes = 8192;
+
+// row kernels of the closure engine
+enum ClosureKernel {
+    kClosureAuto,   // the widest one the CPU supports
+    kClosureScalar, // 64-bit words, any CPU
+    kClosureAVX2,   // 256-bit row ops, x86 with AVX2
+    kClosureAVX512, // 512-bit row ops, x86 with AVX-512F
+};
+
+// The kernel that runs when 'kernel' is asked for: itself if the CPU
+// supports it, else the widest one it does.
+ClosureKernel ResolveClosureKernel(ClosureKernel kernel);
+
+// "scalar", "avx2", ...
+const char *ClosureKernelName(ClosureKernel kernel);
+
+// ReachabilityClosure
+//
+// Transitive closure of a CFG as a dense bit matrix, which
+// FindClosureLoops() leaves behind for reachability queries on the
+// graph it analyzed. Nodes of one SCC reach the same nodes, so there is
+// one row per SCC. The loop nest is kept alongside, for IsBackEdge().
+// A closure filled again reuses its storage.
+//
+class ReachabilityClosure {
+public:
+    typedef CSRGraph::NodeId NodeId;
+
+    ReachabilityClosure() : num_nodes_(0), words_(0) {}
+
+    // Drop the closure, keeping the storage.
+    void Clear();
+
+    // no closure: never filled, cleared, or the graph was too large
+    bool empty() const { return num_nodes_ == 0; }
+
+    NodeId GetNumNodes() const { return num_nodes_; }
+
+    // whether a path of one or more edges leads from 'from' to 'to'
+    bool Reaches(NodeId from, NodeId to) const {
+        const uint64_t *row = &rows_[component_[from] * words_];
+        return (row[to >> 6] >> (to & 63)) & 1;
+    }
+
+    // whether 'node' is on a cycle, its own row holding it
+    bool OnCycle(NodeId node) const { return Reaches(node, node); }
+
+    // whether 'a' and 'b' are in the same SCC: each in the other's row
+    bool InSameScc(NodeId a, NodeId b) const {
+        return a == b || (Reaches(a, b) && Reaches(b, a));
+    }
+
+    // Whether the edge from -> to closes a loop: 'to' is the header of a
+    // loop holding 'from', in its own blocks or a nested loop's. Every
+    // such edge has Reaches(to, from); the others with it enter a loop
+    // nested in 'to's SCC, or come from a node no loop holds.
+    bool IsBackEdge(NodeId from, NodeId to) const;
+
+private:
+    friend class ClosureHooks;
+
+    NodeId num_nodes_;
+    size_t words_;                   // words per row, a multiple of 8
+    std::vector<uint64_t> rows_;     // nodes each SCC reaches
+    std::vector<NodeId> component_;  // row of each node
+    std::vector<NodeId> header_of_;  // header of the innermost loop
+                                     // holding each node, or kNoNode
+    std::vector<NodeId> parent_of_;  // for headers: the enclosing loop's
+};
+
+// tuning knobs for the closure engine
+struct ClosureOptions {
+    // scratch memory for the search (see loop-workspace.h); NULL uses
+    // the heap
+    LoopAnalysisWorkspace *workspace = nullptr;
+
+    // receives the closure of the graph; NULL only finds the loops
+    ReachabilityClosure *closure = nullptr;
+
+    // row kernel for the closure
+    ClosureKernel kernel = kClosureAuto;
+};
+
+// entry point for the closure engine, which builds the same loop forest
+// as FindHavlakLoops; graphs of more than kMaxClosureNodes nodes go to
+// Tarjan's algorithm, and get no closure
+int FindClosureLoops(MaoCFG *CFG, LoopStructureGraph *LSG);
+
+// same, running directly on a frozen CSR snapshot
+int FindClosureLoops(const CSRGraph &graph, LoopStructureGraph *LSG);
+
+// same, with explicit options
+int FindClosureLoops(const CSRGraph &graph, LoopStructureGraph *LSG,
+                     const ClosureOptions &options);
+
+// whether the closure engine builds the matrix for 'graph', rather than
+// leaving it to Tarjan's algorithm
+bool FitsClosureMatrix(const CSRGraph &graph);
+
+#endif // CLOSURE_LOOPS_H_
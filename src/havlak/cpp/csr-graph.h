@@ -0,0 +1,87 @@
+#ifndef CSR_GRAPH_H_
+#define CSR_GRAPH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Forward Decls
+class BasicBlock;
+class MaoCFG;
+
+// [begin, end) view over a contiguous array, usable in range-based for loops
+template <typename T>
+class ArrayRange {
+public:
+    ArrayRange(T *begin, T *end) : begin_(begin), end_(end) {}
+
+    T *begin() const { return begin_; }
+    T *end() const { return end_; }
+    size_t size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+    T &operator[](size_t i) const { return begin_[i]; }
+
+private:
+    T *begin_, *end_;
+};
+
+// CSRGraph
+//
+// Immutable compressed-sparse-row snapshot of a MaoCFG. Nodes are
+// identified by the dense 32-bit BasicBlock indices, and the in- and
+// out-edges of all nodes live in two contiguous target arrays indexed
+// by per-node offsets, so the loop finders can walk adjacency and keep
+// per-node state in flat arrays instead of chasing BasicBlock pointers
+// through maps.
+//
+// Edge order per node matches the BasicBlock edge vectors the snapshot
+// was taken from, so traversals visit nodes in the same order.
+//
+class CSRGraph {
+public:
+    typedef uint32_t NodeId;
+    typedef ArrayRange<const NodeId> NodeRange;
+
+    // Marker for "no node", e.g. the start node of an empty graph.
+    static constexpr NodeId kNoNode = UINT32_MAX;
+
+    CSRGraph() : start_node_(kNoNode) {
+    }
+
+    NodeId GetNumNodes() const { return blocks_.size(); }
+    size_t GetNumEdges() const { return out_targets_.size(); }
+    NodeId start_node() const { return start_node_; }
+
+    NodeRange out_edges(NodeId v) const {
+        return NodeRange(out_targets_.data() + out_offsets_[v],
+                         out_targets_.data() + out_offsets_[v + 1]);
+    }
+
+    NodeRange in_edges(NodeId v) const {
+        return NodeRange(in_targets_.data() + in_offsets_[v],
+                         in_targets_.data() + in_offsets_[v + 1]);
+    }
+
+    uint32_t GetNumSucc(NodeId v) const {
+        return out_offsets_[v + 1] - out_offsets_[v];
+    }
+
+    uint32_t GetNumPred(NodeId v) const {
+        return in_offsets_[v + 1] - in_offsets_[v];
+    }
+
+    // BasicBlock the dense id was assigned to.
+    BasicBlock *block(NodeId v) const { return blocks_[v]; }
+
+private:
+    friend class MaoCFG;
+
+    NodeId start_node_;
+    std::vector<BasicBlock *> blocks_;  // id -> block
+    std::vector<uint32_t> out_offsets_; // GetNumNodes() + 1 entries
+    std::vector<NodeId> out_targets_;
+    std::vector<uint32_t> in_offsets_;  // GetNumNodes() + 1 entries
+    std::vector<NodeId> in_targets_;
+};
+
+#endif // CSR_GRAPH_H_
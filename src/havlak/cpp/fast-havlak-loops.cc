@@ -0,0 +1,647 @@
+#include <algorithm>
+#include <memory>
+#include <memory_resource>
+#include <stdio.h>
+#include <vector>
+
+#include "fast-havlak-loops.h"
+#include "loop-workspace.h"
+#include "mao-loops.h"
+#include "pearce-scc.h"
+#include "union-find.h"
+
+// Havlak's loop recognition (see mao-loops.cc for the reference
+// version and the paper) on flat arrays:
+//
+//   - back and non-back predecessors are compact CSR arrays over DFS
+//     numbers, the non-back ones sorted and deduplicated per node;
+//   - the few non-back predecessors added for irreducible loops go to a
+//     linked overflow list in flat arrays;
+//   - the node pool P doubles as the worklist (the reference version
+//     pushes every node to both), and membership in P is an
+//     epoch-stamped array instead of a linear search.
+//
+// Predecessors are visited in the same order as the reference version's
+// std::set, so the resulting loop forest is identical, including the
+// order of blocks and children.
+class FastHavlakLoopFinder {
+public:
+    typedef CSRGraph::NodeId NodeId;
+
+    // marker for uninitialized nodes
+    static const int kUnvisited = -1;
+    // safeguard against pathologic algorithm behavior
+    static const int kMaxNonBackPreds = 32 * 1024;
+
+    // Arrays are taken from 'memory'.
+    FastHavlakLoopFinder(const CSRGraph &graph, LoopStructureGraph *lsg,
+                         std::pmr::memory_resource *memory =
+                             std::pmr::get_default_resource())
+        : FastHavlakLoopFinder(graph, lsg, memory, nullptr, 0, graph.start_node(),
+                               graph.GetNumNodes(), nullptr) {}
+
+    // Restricted to the 'size' nodes with regionOf[node] == region, which
+    // must all be reachable from 'start' within the region. 'number' is
+    // indexed by node id and may be shared with finders of other regions;
+    // it must be kUnvisited for the nodes of this one.
+    FastHavlakLoopFinder(const CSRGraph &graph, LoopStructureGraph *lsg,
+                         std::pmr::memory_resource *memory,
+                         const NodeId *regionOf, NodeId region, NodeId start,
+                         int size, int *number)
+        : graph_(graph), lsg_(lsg), memory_(memory), regionOf_(regionOf),
+          region_(region), start_(start), size_(size), number_(number),
+          ownNumber_(memory), vertex_(memory), last_(memory),
+          backOffsets_(memory), backPreds_(memory), nonBackOffsets_(memory),
+          nonBackPreds_(memory), extraHead_(memory), extraNext_(memory),
+          extraPred_(memory), merged_(memory), sets_(memory),
+          setHeader_(memory), loops_(memory), pool_(memory),
+          poolStamp_(memory) {}
+
+    void FindLoops() {
+        if (start_ == CSRGraph::kNoNode)
+            return;
+
+        int size = size_;
+
+        // step a: depth-first numbering, unreached nodes are dead
+        if (!regionOf_) {
+            ownNumber_.assign(graph_.GetNumNodes(), kUnvisited);
+            number_ = ownNumber_.data();
+        }
+        vertex_.resize(size);
+        last_.resize(size);
+        int reached = NumberNodes() + 1;
+
+        // step b: split the predecessors of every reached node into
+        // back edges (from descendants) and non-back edges
+        ClassifyPreds(reached);
+
+        sets_.Reset(reached);
+        setHeader_.resize(reached);
+        for (int w = 0; w < reached; w++)
+            setHeader_[w] = w;
+        loops_.assign(reached, nullptr);
+        poolStamp_.assign(reached, kUnvisited);
+        extraHead_.assign(reached, kUnvisited);
+        extraNext_.clear();
+        extraPred_.clear();
+
+        // step c: headers in reverse preorder, inner loops first
+        for (int w = reached - 1; w >= 0; w--) {
+            pool_.clear();
+            bool selfLoop = false;
+
+            // step d: seed P with the collapsed sources of back edges
+            for (int i = backOffsets_[w]; i < backOffsets_[w + 1]; i++) {
+                int v = backPreds_[i];
+                if (v == w) {
+                    selfLoop = true;
+                    continue;
+                }
+                AddToPool(FindSet(v), w);
+            }
+
+            // step e: chase non-back predecessors up from P; pool_ is
+            // the worklist, 'next' its front
+            for (size_t next = 0; next < pool_.size(); next++) {
+                int x = pool_[next];
+
+                const int *preds;
+                int numPreds;
+                NonBackPreds(x, &preds, &numPreds);
+
+                // the algorithm has degenerated
+                if (numPreds > kMaxNonBackPreds) {
+                    lsg_->KillAll();
+                    return;
+                }
+
+                for (int i = 0; i < numPreds; i++) {
+                    int ydash = FindSet(preds[i]);
+
+                    if (!IsAncestor(w, ydash)) {
+                        // another entry avoids w: irreducible loop
+                        AddExtraPred(w, ydash);
+                    } else if (ydash != w) {
+                        AddToPool(ydash, w);
+                    }
+                }
+            }
+
+            // collapse P into w and link its loop into the forest
+            if (!pool_.empty() || selfLoop) {
+                SimpleLoop *loop = lsg_->CreateNewLoop();
+                loops_[w] = loop;
+                loop->set_header(graph_.block(vertex_[w]));
+
+                for (int node : pool_) {
+                    Union(node, w);
+
+                    // nested loops are not added, but linked together
+                    if (loops_[node])
+                        loops_[node]->set_parent(loop);
+                    else
+                        loop->AddNode(graph_.block(vertex_[node]));
+                }
+
+                lsg_->AddLoop(loop);
+            }
+        }
+    }
+
+private:
+    bool InRegion(NodeId node) const {
+        return !regionOf_ || regionOf_[node] == region_;
+    }
+
+    bool IsAncestor(int w, int v) const {
+        return w <= v && v <= last_[w];
+    }
+
+    int FindSet(int v) {
+        return setHeader_[sets_.Find(v)];
+    }
+
+    void Union(int v, int w) {
+        setHeader_[sets_.Union(v, w)] = w;
+    }
+
+    // add a collapsed node to P for header w, unless it is already there
+    void AddToPool(int node, int w) {
+        if (poolStamp_[node] == w)
+            return;
+        poolStamp_[node] = w;
+        pool_.push_back(node);
+    }
+
+    // iterative DFS numbering, same preorder and 'last' as the reference
+    // version's; returns the highest number handed out
+    int NumberNodes() {
+        struct Frame {
+            NodeId node;
+            const NodeId *next;
+            const NodeId *end;
+        };
+        std::pmr::vector<Frame> stack(memory_);
+        stack.reserve(size_);
+
+        NodeId start = start_;
+        int lastId = 0;
+        number_[start] = 0;
+        vertex_[0] = start;
+        CSRGraph::NodeRange edges = graph_.out_edges(start);
+        stack.push_back(Frame{start, edges.begin(), edges.end()});
+
+        while (!stack.empty()) {
+            Frame &top = stack.back();
+            if (top.next == top.end) {
+                last_[number_[top.node]] = lastId;
+                stack.pop_back();
+                continue;
+            }
+
+            NodeId target = *top.next++;
+            if (!InRegion(target) || number_[target] != kUnvisited)
+                continue;
+
+            number_[target] = ++lastId;
+            vertex_[lastId] = target;
+            edges = graph_.out_edges(target);
+            stack.push_back(Frame{target, edges.begin(), edges.end()});
+        }
+        return lastId;
+    }
+
+    // fill the back/non-back predecessor CSR arrays over DFS numbers
+    void ClassifyPreds(int reached) {
+        backOffsets_.assign(reached + 1, 0);
+        nonBackOffsets_.assign(reached + 1, 0);
+        for (int w = 0; w < reached; w++) {
+            for (NodeId pred : graph_.in_edges(vertex_[w])) {
+                if (!InRegion(pred))
+                    continue;
+                int v = number_[pred];
+                if (v == kUnvisited)
+                    continue; // dead node
+                if (IsAncestor(w, v))
+                    backOffsets_[w + 1]++;
+                else
+                    nonBackOffsets_[w + 1]++;
+            }
+        }
+        for (int w = 0; w < reached; w++) {
+            backOffsets_[w + 1] += backOffsets_[w];
+            nonBackOffsets_[w + 1] += nonBackOffsets_[w];
+        }
+
+        backPreds_.resize(backOffsets_[reached]);
+        nonBackPreds_.resize(nonBackOffsets_[reached]);
+        int nonBackOut = 0;
+        for (int w = 0; w < reached; w++) {
+            int back = backOffsets_[w];
+            int nonBackBegin = nonBackOffsets_[w];
+            int nonBack = nonBackBegin;
+            for (NodeId pred : graph_.in_edges(vertex_[w])) {
+                if (!InRegion(pred))
+                    continue;
+                int v = number_[pred];
+                if (v == kUnvisited)
+                    continue;
+                if (IsAncestor(w, v))
+                    backPreds_[back++] = v;
+                else
+                    nonBackPreds_[nonBack++] = v;
+            }
+
+            // sorted and unique, like the reference version's std::set;
+            // compact in place since duplicates shrink the segment
+            std::sort(nonBackPreds_.begin() + nonBackBegin,
+                      nonBackPreds_.begin() + nonBack);
+            int *end = std::unique(nonBackPreds_.data() + nonBackBegin,
+                                   nonBackPreds_.data() + nonBack);
+            nonBackOffsets_[w] = nonBackOut;
+            for (int *p = nonBackPreds_.data() + nonBackBegin; p != end; ++p)
+                nonBackPreds_[nonBackOut++] = *p;
+        }
+        nonBackOffsets_[reached] = nonBackOut;
+    }
+
+    // record an extra non-back predecessor of w (irreducible entry)
+    void AddExtraPred(int w, int pred) {
+        extraPred_.push_back(pred);
+        extraNext_.push_back(extraHead_[w]);
+        extraHead_[w] = extraPred_.size() - 1;
+    }
+
+    // non-back predecessors of x in ascending order, merged with any
+    // extra ones recorded for x
+    void NonBackPreds(int x, const int **preds, int *numPreds) {
+        const int *begin = nonBackPreds_.data() + nonBackOffsets_[x];
+        int count = nonBackOffsets_[x + 1] - nonBackOffsets_[x];
+        if (extraHead_[x] == kUnvisited) {
+            *preds = begin;
+            *numPreds = count;
+            return;
+        }
+
+        merged_.assign(begin, begin + count);
+        for (int e = extraHead_[x]; e != kUnvisited; e = extraNext_[e])
+            merged_.push_back(extraPred_[e]);
+        std::sort(merged_.begin(), merged_.end());
+        merged_.erase(std::unique(merged_.begin(), merged_.end()), merged_.end());
+        *preds = merged_.data();
+        *numPreds = merged_.size();
+    }
+
+    const CSRGraph &graph_;                 // snapshot of the control flow graph
+    LoopStructureGraph *lsg_;               // loop forest
+    std::pmr::memory_resource *memory_;     // scratch for all arrays
+
+    const NodeId *regionOf_;                // node id -> region, or null
+    NodeId region_;                         // the region searched
+    NodeId start_;                          // DFS root
+    int size_;                              // nodes in the region
+
+    int *number_;                           // node id -> DFS number
+    std::pmr::vector<int> ownNumber_;       // number_ unless shared
+    std::pmr::vector<NodeId> vertex_;       // DFS number -> node id
+    std::pmr::vector<int> last_;            // DFS number -> last descendant
+
+    std::pmr::vector<int> backOffsets_;     // DFS number -> backPreds_
+    std::pmr::vector<int> backPreds_;
+    std::pmr::vector<int> nonBackOffsets_;  // DFS number -> nonBackPreds_
+    std::pmr::vector<int> nonBackPreds_;
+    std::pmr::vector<int> extraHead_;       // DFS number -> first extra pred
+    std::pmr::vector<int> extraNext_;
+    std::pmr::vector<int> extraPred_;
+    std::pmr::vector<int> merged_;          // scratch for NonBackPreds
+
+    UnionFind<int> sets_;                   // collapsed loop bodies
+    std::pmr::vector<int> setHeader_;       // header naming each set
+    std::pmr::vector<SimpleLoop *> loops_;  // loop headed by each node, if any
+    std::pmr::vector<int> pool_;            // P, also the worklist
+    std::pmr::vector<int> poolStamp_;       // header whose P holds the node
+};
+
+const int FastHavlakLoopFinder::kUnvisited;
+const int FastHavlakLoopFinder::kMaxNonBackPreds;
+
+// Havlak's algorithm run on independent parts of the graph at once.
+//
+// A loop's body is the SCC its header forms within the header's DFS
+// subtree, and that subtree numbers the SCC's nodes in the same order
+// whether the search starts at the start node or at the header. The
+// SCCs of the graph are thus the outermost loops, and Havlak's
+// algorithm run on each SCC alone finds the same forest as on the
+// whole graph; the loops nested in an SCC are in turn the SCCs of its
+// body without the header.
+//
+// A serial Pearce pass splits the graph into its SCCs. An SCC too large
+// for one task is split again along its header's loop, and so on down.
+// A split that leaves nearly all of the SCC in one nested SCC buys no
+// parallelism; after a few of those in a row, as in a deep nest, the
+// SCC is left whole rather than searched over and over.
+// The pieces left ("leaves") go to the pool in batches, each batch into
+// a LoopStructureGraph of its own, and their forests are then copied
+// into the result in the order the leaves were found, below the loops
+// split up on the way.
+class ParallelHavlakLoopFinder {
+public:
+    typedef CSRGraph::NodeId NodeId;
+
+    // SCCs larger than this are split if the pool has workers
+    static const size_t kSplitSize = 4096;
+    // leaf nodes handed to one task
+    static const NodeId kBatchSize = 1024;
+    // splits in a row that may keep 7/8 of an SCC together
+    static const int kMaxPeels = 4;
+
+    ParallelHavlakLoopFinder(const CSRGraph &graph, LoopStructureGraph *lsg,
+                             const ParallelHavlakOptions &options,
+                             std::pmr::memory_resource *memory)
+        : graph_(graph), lsg_(lsg), memory_(memory), scc_(graph, memory),
+          region_of_(memory), region_(0), region_header_(CSRGraph::kNoNode),
+          number_(memory), found_(memory), components_(memory),
+          pending_(memory), members_(memory), body_(memory), leaves_(memory),
+          batches_(memory),
+          tasks_(options.pool ? options.pool : ThreadPool::Default()) {}
+
+    void FindLoops() {
+        if (graph_.start_node() == CSRGraph::kNoNode)
+            return;
+
+        // all unvisited, all in the outermost region
+        NodeId size = graph_.GetNumNodes();
+        scc_.Reset();
+        region_of_.assign(size, region_);
+        number_.assign(size, FastHavlakLoopFinder::kUnvisited);
+        split_ = tasks_.pool()->num_workers() > 0;
+
+        // the outermost loops are the SCCs reachable from the start node
+        Search(graph_.start_node());
+        PushSccs(nullptr, 0);
+
+        while (!pending_.empty()) {
+            Pending scc = pending_.back();
+            pending_.pop_back();
+            body_.assign(members_.begin() + scc.begin, members_.end());
+            members_.resize(scc.begin);
+            if (!split_ || body_.size() <= kSplitSize || !Split(scc))
+                AddLeaf(scc);
+        }
+
+        RunLeaves();
+        Stitch();
+    }
+
+private:
+    // an SCC (in members_ from 'begin' on) not looked at yet
+    struct Pending {
+        size_t begin;
+        NodeId header;
+        SimpleLoop *parent; // enclosing loop split up, or null
+        int peels;          // splits in a row that hardly shrank it
+    };
+
+    // an SCC left to Havlak's algorithm, its nodes marked with 'region'
+    struct Leaf {
+        NodeId header;
+        NodeId region;
+        NodeId size;
+        SimpleLoop *parent;
+        int loopsEnd; // loop counter in its batch's result after it
+    };
+
+    // consecutive leaves run by one task
+    struct Batch {
+        size_t first;
+        size_t last;
+        std::unique_ptr<LoopStructureGraph> result;
+    };
+
+    // an SCC found by Search(), in found_[begin, end), root last
+    struct Component {
+        size_t begin;
+        size_t end;
+    };
+
+    // edges leaving the region, or entering its header, are ignored
+    bool InRegion(NodeId node) const {
+        return region_of_[node] == region_ && node != region_header_;
+    }
+
+    bool IsLoop(const Component &scc) const {
+        if (scc.end - scc.begin > 1)
+            return true;
+        NodeId node = found_[scc.begin];
+        for (NodeId succ : graph_.out_edges(node)) {
+            if (succ == node)
+                return true;
+        }
+        return false;
+    }
+
+    // collect the SCCs reachable from 'start' in the current region
+    void Search(NodeId start) {
+        found_.clear();
+        components_.clear();
+        scc_.Search(start,
+                    [this](NodeId node) { return InRegion(node); },
+                    [this](NodeId root, const NodeId *first, const NodeId *last) {
+                        if (root == region_header_)
+                            return;
+                        components_.push_back(Component{found_.size(),
+                                                        found_.size() + (last - first)});
+                        found_.insert(found_.end(), first, last);
+                    });
+    }
+
+    // queue the loops among the SCCs found, and add the other nodes to
+    // 'parent' (the outermost SCCs have none)
+    void PushSccs(SimpleLoop *parent, int peels) {
+        for (const Component &scc : components_) {
+            if (!IsLoop(scc)) {
+                if (parent)
+                    parent->AddNode(graph_.block(found_[scc.begin]));
+                continue;
+            }
+            pending_.push_back(Pending{members_.size(), found_[scc.end - 1],
+                                       parent, peels});
+            members_.insert(members_.end(), found_.begin() + scc.begin,
+                            found_.begin() + scc.end);
+        }
+    }
+
+    // turn the SCC in body_ into its header's loop and queue the SCCs of
+    // its body, unless one of them has held nearly all of it too often
+    bool Split(const Pending &scc) {
+        region_++;
+        for (NodeId v : body_) {
+            region_of_[v] = region_;
+            scc_.Unvisit(v);
+        }
+        region_header_ = scc.header;
+        Search(scc.header);
+
+        size_t largest = 0;
+        for (const Component &nested : components_)
+            largest = std::max(largest, nested.end - nested.begin);
+        int peels = 0;
+        if (largest * 8 > (body_.size() - 1) * 7) {
+            if (scc.peels == kMaxPeels)
+                return false;
+            peels = scc.peels + 1;
+        }
+
+        SimpleLoop *loop = lsg_->CreateNewLoop();
+        loop->set_header(graph_.block(scc.header));
+        loop->set_parent(scc.parent ? scc.parent : lsg_->root());
+        lsg_->AddLoop(loop);
+        PushSccs(loop, peels);
+        return true;
+    }
+
+    void AddLeaf(const Pending &scc) {
+        region_++;
+        for (NodeId v : body_)
+            region_of_[v] = region_;
+        leaves_.push_back(Leaf{scc.header, region_,
+                               static_cast<NodeId>(body_.size()), scc.parent, 0});
+    }
+
+    // run Havlak's algorithm on every leaf, consecutive leaves of up to
+    // kBatchSize nodes together
+    void RunLeaves() {
+        size_t first = 0;
+        while (first < leaves_.size()) {
+            size_t last = first;
+            NodeId nodes = 0;
+            while (last < leaves_.size() && (last == first || nodes < kBatchSize))
+                nodes += leaves_[last++].size;
+            batches_.push_back(Batch{first, last, nullptr});
+            first = last;
+        }
+
+        for (Batch &batch : batches_)
+            tasks_.Run([this, &batch] { RunBatch(&batch); });
+        tasks_.Wait();
+    }
+
+    void RunBatch(Batch *batch) {
+        batch->result.reset(new LoopStructureGraph());
+        LoopStructureGraph *result = batch->result.get();
+        for (size_t i = batch->first; i < batch->last; ++i) {
+            Leaf &leaf = leaves_[i];
+            FastHavlakLoopFinder finder(graph_, result, std::pmr::get_default_resource(),
+                                        region_of_.data(), leaf.region, leaf.header,
+                                        leaf.size, number_.data());
+            finder.FindLoops();
+
+            // Havlak's algorithm has degenerated
+            if (!result->root())
+                return;
+            leaf.loopsEnd = result->GetNumLoops();
+        }
+    }
+
+    // copy the batches' loops into lsg_, each leaf's outermost one below
+    // the loop it was split off, or the root
+    void Stitch() {
+        std::pmr::vector<SimpleLoop *> copies(memory_);
+        for (Batch &batch : batches_) {
+            LoopStructureGraph *result = batch.result.get();
+            if (!result->root()) {
+                lsg_->KillAll();
+                return;
+            }
+
+            copies.assign(result->GetNumLoops(), nullptr);
+            for (SimpleLoop *loop : result->GetLoops()) {
+                if (loop->is_root())
+                    continue;
+                SimpleLoop *copy = lsg_->CreateNewLoop();
+                copy->set_header(loop->header());
+                for (BasicBlock *block : loop->GetBasicBlocks())
+                    copy->AddNode(block);
+                copies[loop->counter()] = copy;
+            }
+
+            // loops come in the order the leaves ran, root first
+            size_t leaf = batch.first;
+            for (SimpleLoop *loop : result->GetLoops()) {
+                if (loop->is_root())
+                    continue;
+                while (loop->counter() >= leaves_[leaf].loopsEnd)
+                    ++leaf;
+                SimpleLoop *copy = copies[loop->counter()];
+                if (loop->parent())
+                    copy->set_parent(copies[loop->parent()->counter()]);
+                else if (leaves_[leaf].parent)
+                    copy->set_parent(leaves_[leaf].parent);
+                else
+                    copy->set_parent(lsg_->root());
+                lsg_->AddLoop(copy);
+            }
+            batch.result.reset();
+        }
+    }
+
+    const CSRGraph &graph_;
+    LoopStructureGraph *lsg_;
+    std::pmr::memory_resource *memory_;    // scratch of the calling thread
+    PearceSCC<CSRGraph> scc_;
+    bool split_;                           // whether splitting SCCs pays off
+
+    std::pmr::vector<NodeId> region_of_;   // node id -> region
+    NodeId region_;                        // region being searched, or latest
+    NodeId region_header_;                 // its header, excluded from it
+    std::pmr::vector<int> number_;         // DFS numbers, shared by the leaves
+
+    std::pmr::vector<NodeId> found_;       // nodes of the SCCs found
+    std::pmr::vector<Component> components_;
+    std::pmr::vector<Pending> pending_;
+    std::pmr::vector<NodeId> members_;     // nodes of the pending SCCs
+    std::pmr::vector<NodeId> body_;        // SCC being looked at
+
+    std::pmr::vector<Leaf> leaves_;
+    std::pmr::vector<Batch> batches_;
+    TaskGroup tasks_;
+};
+
+const size_t ParallelHavlakLoopFinder::kSplitSize;
+const CSRGraph::NodeId ParallelHavlakLoopFinder::kBatchSize;
+const int ParallelHavlakLoopFinder::kMaxPeels;
+
+int FindFastHavlakLoops(MaoCFG *CFG, LoopStructureGraph *LSG) {
+    CSRGraph graph;
+    CFG->BuildSnapshot(&graph);
+    return FindFastHavlakLoops(graph, LSG);
+}
+
+int FindFastHavlakLoops(const CSRGraph &graph, LoopStructureGraph *LSG) {
+    return FindFastHavlakLoops(graph, LSG, nullptr);
+}
+
+int FindFastHavlakLoops(const CSRGraph &graph, LoopStructureGraph *LSG,
+                        LoopAnalysisWorkspace *workspace) {
+    FastHavlakLoopFinder finder(graph, LSG, BeginScratch(workspace));
+    finder.FindLoops();
+    return LSG->GetNumLoops();
+}
+
+int FindParallelHavlakLoops(MaoCFG *CFG, LoopStructureGraph *LSG) {
+    CSRGraph graph;
+    CFG->BuildSnapshot(&graph);
+    return FindParallelHavlakLoops(graph, LSG);
+}
+
+int FindParallelHavlakLoops(const CSRGraph &graph, LoopStructureGraph *LSG) {
+    return FindParallelHavlakLoops(graph, LSG, ParallelHavlakOptions());
+}
+
+int FindParallelHavlakLoops(const CSRGraph &graph, LoopStructureGraph *LSG,
+                            const ParallelHavlakOptions &options) {
+    ParallelHavlakLoopFinder finder(graph, LSG, options, BeginScratch(options.workspace));
+    finder.FindLoops();
+    return LSG->GetNumLoops();
+}
@@ -0,0 +1,45 @@
+#ifndef FAST_HAVLAK_LOOPS_H_
+#define FAST_HAVLAK_LOOPS_H_
+
+#include "mao-loops.h"
+#include "thread-pool.h"
+
+// forward declaration of the FastHavlakLoopFinder class
+class FastHavlakLoopFinder;
+
+// tuning knobs for the SCC-partitioned parallel Havlak engine
+struct ParallelHavlakOptions {
+    // pool running Havlak's algorithm on the SCCs; the calling thread
+    // helps out while it waits. NULL means ThreadPool::Default().
+    ThreadPool *pool = nullptr;
+
+    // scratch memory for the calling thread's arrays (see
+    // loop-workspace.h); NULL uses the heap
+    LoopAnalysisWorkspace *workspace = nullptr;
+};
+
+// entry point for the flat-array Havlak engine; builds the same loop
+// forest as FindHavlakLoops
+int FindFastHavlakLoops(MaoCFG *CFG, LoopStructureGraph *LSG);
+
+// same, running directly on a frozen CSR snapshot
+int FindFastHavlakLoops(const CSRGraph &graph, LoopStructureGraph *LSG);
+
+// same, with the scratch memory taken from 'workspace' (see
+// loop-workspace.h); NULL uses the heap
+int FindFastHavlakLoops(const CSRGraph &graph, LoopStructureGraph *LSG,
+                        LoopAnalysisWorkspace *workspace);
+
+// entry point for Havlak's algorithm run on the strongly connected
+// components of the graph in parallel; builds the same loop forest as
+// FindHavlakLoops, with the outermost loops linked below the root
+int FindParallelHavlakLoops(MaoCFG *CFG, LoopStructureGraph *LSG);
+
+// same, running directly on a frozen CSR snapshot
+int FindParallelHavlakLoops(const CSRGraph &graph, LoopStructureGraph *LSG);
+
+// same, with explicit options
+int FindParallelHavlakLoops(const CSRGraph &graph, LoopStructureGraph *LSG,
+                            const ParallelHavlakOptions &options);
+
+#endif // FAST_HAVLAK_LOOPS_H_
@@ -0,0 +1,1084 @@
+#ifndef FWBW_LOOPS_INL_H_
+#define FWBW_LOOPS_INL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory_resource>
+#include <stdint.h>
+#include <vector>
+
+#include "atomic-bitmap.h"
+#include "fwbw-loops.h"
+#include "graph-traits.h"
+#include "loop-workspace.h"
+#include "mao-loops.h"
+#include "pearce-scc.h"
+#include "scc-records.h"
+#include "scratch-array.h"
+#include "thread-pool.h"
+
+// PartitionGraph
+//
+// A partition of the FWBW engine copied out as a graph of its own: its
+// nodes numbered from 0 in the order of its range, and the edges between
+// them. Partitions too small for a task are searched serially on one.
+//
+struct PartitionGraph {
+    explicit PartitionGraph(std::pmr::memory_resource *memory)
+        : offsets(memory), targets(memory) {}
+
+    std::pmr::vector<uint32_t> offsets; // one entry per node, then the end
+    std::pmr::vector<uint32_t> targets;
+};
+
+// the part of GraphTraits PearceSCC needs
+template <>
+struct GraphTraits<PartitionGraph> {
+    typedef uint32_t NodeId;
+    typedef const NodeId *EdgeIterator;
+    typedef ArrayRange<const NodeId> EdgeRange;
+
+    static constexpr NodeId kNoNode = UINT32_MAX;
+
+    static NodeId NumNodes(const PartitionGraph &g) { return g.offsets.size() - 1; }
+
+    static EdgeRange Successors(const PartitionGraph &g, NodeId v) {
+        return EdgeRange(g.targets.data() + g.offsets[v], g.targets.data() + g.offsets[v + 1]);
+    }
+};
+
+// parallel Forward-Backward Trim algorithm for finding loops
+//
+// Partitions are kept coloring-style: every node carries the color of
+// the partition it is in, and each partition is a contiguous range of
+// order_. Splitting a partition recolors its nodes and reorders its
+// range in place, so membership tests are array reads and nothing is
+// copied between recursion levels. A task only ever writes the colors
+// of nodes in its own partition; colors are atomic because it reads
+// those of neighbors that other tasks may be recoloring.
+//
+// The SCCs are the outermost loops. Each SCC's body without its header
+// is then a partition of its own, whose SCCs are the loops nested in it,
+// and so on down (see scc-records.h). Every level splits its partitions
+// anew, so deeply nested loops cost up to n times their depth.
+//
+// A single pivot splits off little of a partition that is a chain of
+// SCCs, as CFGs are, so partitions may be split around many pivots at
+// once (see SplitByPivots()). Which nodes the pivots are is up to
+// FWBWOptions::pivot (see ChoosePivots()).
+//
+// Partitions become tasks only if they are worth one: work below the
+// grain, estimated from their edges, stays on the thread that split it
+// off, and once trimmed is finished there by a serial search (see
+// FinishSerially()). Without the serial search such partitions go on a
+// stack of that thread's pending ones instead of being recursed into: a
+// chain of SCCs split one at a time would nest thousands deep.
+//
+// 'Graph' is any graph with GraphTraits (see graph-traits.h).
+template <typename Graph>
+class FWBWLoopFinder {
+public:
+    typedef GraphTraits<Graph> Traits;
+    typedef typename Traits::NodeId NodeId;
+    typedef uint32_t Color;
+
+    // color of trimmed nodes and finished SCCs, never a live partition
+    static const Color kNoPartition = 0;
+
+    // per-node arrays are taken from 'memory', the partitions' scratch
+    // from the thread-safe 'shared'
+    FWBWLoopFinder(const Graph &graph, LoopStructureGraph *lsg,
+                   const FWBWOptions &options, std::pmr::memory_resource *memory,
+                   std::pmr::memory_resource *shared)
+        : graph_(graph), lsg_(lsg), shared_(shared), color_(memory), order_(memory),
+          inDegree_(memory), outDegree_(memory), nextColor_(kNoPartition + 1),
+          descendants_(memory), predecessors_(memory),
+          pivots_(std::max(1, std::min(options.pivots, kMaxPivots))),
+          forwardLanes_(memory), backwardLanes_(memory), newLanes_(memory),
+          pivot_(options.pivot), seed_(options.seed), grain_(options.grain),
+          serial_(options.serial), local_(memory), stats_(options.stats),
+          splits_(0), pivotsSearched_(0), splitNodes_(0), largestNodes_(0), depth_(0),
+          tasksRun_(0), serialRun_(0),
+          sccs_(graph, memory), tasks_(options.pool ? options.pool : ThreadPool::Default()) {
+    }
+
+    void FindLoops() {
+        if (Traits::StartNode(graph_) == Traits::kNoNode) {
+            ReportStats();
+            return;
+        }
+
+        // one partition holding all nodes
+        NodeId size = Traits::NumNodes(graph_);
+        Color all = NewColor();
+        color_.Reset(size);
+        inDegree_.Reset(size);
+        outDegree_.Reset(size);
+        descendants_.Reset(size);
+        predecessors_.Reset(size);
+        if (pivots_ > 1) {
+            forwardLanes_.Reset(size);
+            backwardLanes_.Reset(size);
+        }
+        if (pivots_ > 1 || pivot_ == kPivotSampled)
+            newLanes_.Reset(size);
+        if (serial_)
+            local_.Reset(size);
+        order_.resize(size);
+        sccs_.Reset();
+        for (NodeId id = 0; id < size; ++id) {
+            color_[id].store(all, std::memory_order_relaxed);
+            order_[id] = id;
+        }
+
+        if (!grain_)
+            grain_ = CalibratedGrain();
+        Pending pending(shared_);
+        ProcessPartition(Partition{0, size, all, Traits::kNoNode, 1, 0}, &pending);
+        FindPendingLoops(&pending);
+
+        // barrier, helping with the partitions still queued
+        tasks_.Wait();
+
+        sccs_.BuildForest(order_, lsg_);
+
+        lsg_->CalculateNestingLevel();
+        ReportStats();
+    }
+
+    // The partition order_[begin, end) of color 'color', in the body of
+    // the loop with header 'parent' (or kNoNode), to be split around up
+    // to 'lanes' pivots at a time; 'depth' splits lie above it.
+    struct Partition {
+        NodeId begin;
+        NodeId end;
+        Color color;
+        NodeId parent;
+        int lanes;
+        int depth;
+    };
+
+    // partitions left to the thread that split them off
+    typedef std::pmr::vector<Partition> Pending;
+
+    // find the SCCs of 'partition', leaving the partitions split off it
+    // below the grain on 'pending'
+    void FindLoopsRecursive(const Partition &partition, Pending *pending) {
+        NodeId begin = partition.begin;
+        NodeId end = partition.end;
+        Color color = partition.color;
+        NodeId parent = partition.parent;
+        int lanes = partition.lanes;
+        int depth = partition.depth;
+        RecordDepth(depth);
+
+        // strip nodes that cannot be on a cycle, and 2-cycles
+        end = Trim(begin, end, color, parent, depth, pending);
+        if (begin == end)
+            return;
+
+        // not worth splitting for tasks any more
+        if (serial_ && !ReachesGrain(begin, end)) {
+            serialRun_.fetch_add(1, std::memory_order_relaxed);
+            FinishSerially(begin, end, color, parent);
+            return;
+        }
+
+        lanes = std::min(lanes, MaxLanes(begin, end));
+        if (lanes > 1) {
+            SplitByPivots(begin, end, color, parent, lanes, depth, pending);
+            return;
+        }
+
+        // pick a pivot node
+        NodeId pivot;
+        ChoosePivots(begin, end, color, 1, &pivot);
+
+        // color nodes reachable from pivot (descendants), then nodes that
+        // can reach it (predecessors): those that were descendants too
+        // form the SCC
+        Color desc = NewColor();
+        Color pred = NewColor();
+        Color scc = NewColor();
+        if (IsLarge(begin, end)) {
+            SweepInParallel(pivot, begin, end, color, desc, pred, scc);
+        } else {
+            Reach(pivot, true, color, desc, color, desc);
+            Reach(pivot, false, color, pred, desc, scc);
+        }
+
+        // reorder the range into SCC, desc - SCC, pred - SCC, and the
+        // rest, which keeps 'color'
+        NodeId *first = &order_[0] + begin;
+        NodeId *last = &order_[0] + end;
+        NodeId *sccEnd = std::partition(first, last, HasColor(this, scc));
+        NodeId *descEnd = std::partition(sccEnd, last, HasColor(this, desc));
+        NodeId *predEnd = std::partition(descEnd, last, HasColor(this, pred));
+
+        NodeId largest = std::max(std::max<NodeId>(sccEnd - first, descEnd - sccEnd),
+                                  std::max<NodeId>(predEnd - descEnd, last - predEnd));
+        RecordSplit(1, end - begin, largest);
+
+        // queue non-empty partitions that exceed the threshold as tasks,
+        // idle workers steal them
+        lanes = NextLanes(1, sccEnd - first, end - begin);
+        ProcessPartition(Partition{NodeId(sccEnd - &order_[0]), NodeId(descEnd - &order_[0]),
+                                   desc, parent, lanes, depth + 1}, pending);
+        ProcessPartition(Partition{NodeId(descEnd - &order_[0]), NodeId(predEnd - &order_[0]),
+                                   pred, parent, lanes, depth + 1}, pending);
+        ProcessPartition(Partition{NodeId(predEnd - &order_[0]), end, color, parent, lanes,
+                                   depth + 1}, pending);
+
+        // a single node is a loop only if it has a self-loop
+        if (sccEnd - first == 1 && !HasSelfLoop(pivot))
+            return;
+
+        RegisterLoop(first, sccEnd, parent, depth, pending);
+    }
+
+    // Record the SCC order_[first, last), which has a color of its own,
+    // nested in the loop with header 'parent', and search its body for
+    // nested loops.
+    // The header moves to the front of the range and the body behind it
+    // becomes a partition of its own, below the split at 'depth' that
+    // found the SCC.
+    void RegisterLoop(NodeId *first, NodeId *last, NodeId parent, int depth,
+                      Pending *pending) {
+        // find loop header (entry point)
+        NodeId header = sccs_.FindHeader(first, last);
+        std::iter_swap(first, std::find(first, last, header));
+        sccs_.Add(first - &order_[0], last - &order_[0], header, parent);
+
+        // the body's color keeps the header out of it
+        Color body = NewColor();
+        for (NodeId *node = first + 1; node != last; ++node)
+            SetColor(*node, body);
+        ProcessPartition(Partition{NodeId(first + 1 - &order_[0]), NodeId(last - &order_[0]),
+                                   body, header, 1, depth + 1}, pending);
+    }
+
+    // Find the loops of a partition: as a task if its work reaches the
+    // grain, else on this thread, once it gets to it on 'pending'.
+    void ProcessPartition(const Partition &partition, Pending *pending) {
+        if (partition.begin == partition.end)
+            return;
+
+        if (ReachesGrain(partition.begin, partition.end)) {
+            tasksRun_.fetch_add(1, std::memory_order_relaxed);
+            tasks_.Run([this, partition] {
+                Pending pending(1, partition, shared_);
+                FindPendingLoops(&pending);
+            });
+        } else {
+            pending->push_back(partition);
+        }
+    }
+
+    // find the loops of the partitions on 'pending' and of those split
+    // off them, until none is left
+    void FindPendingLoops(Pending *pending) {
+        while (!pending->empty()) {
+            Partition partition = pending->back();
+            pending->pop_back();
+            FindLoopsRecursive(partition, pending);
+        }
+    }
+
+private:
+    // A task should do kTaskCost times the work its overhead would cover,
+    // but no more than kMaxGrain: above, partitions split on one thread
+    // would leave the pool idle. It never goes below the work the
+    // overhead covers, where a task costs more than it saves.
+    static constexpr size_t kTaskCost = 8;
+    static constexpr size_t kMaxGrain = 64 * 1024;
+
+    // The grain for the pool, from its task overhead and the cost of the
+    // serial search. Without workers tasks only cost, so with the serial
+    // search to finish them no partition is worth one.
+    size_t CalibratedGrain() const {
+        ThreadPool *pool = tasks_.pool();
+        if (!pool->num_workers())
+            return serial_ ? SIZE_MAX : kMaxGrain;
+        size_t minGrain = (size_t)(pool->TaskOverhead() / SerialCost()) + 1;
+        return std::max(minGrain, std::min(kTaskCost * minGrain, kMaxGrain));
+    }
+
+    // Nanoseconds the serial search takes per node and edge, measured
+    // once, on a ring of nodes that each have a chord a third of the way
+    // round as well.
+    static double SerialCost() {
+        static const double cost = MeasureSerialCost();
+        return cost;
+    }
+
+    static double MeasureSerialCost() {
+        const uint32_t kNodes = 4096;
+        PartitionGraph ring(std::pmr::get_default_resource());
+        ring.offsets.push_back(0);
+        for (uint32_t v = 0; v < kNodes; ++v) {
+            ring.targets.push_back((v + 1) % kNodes);
+            ring.targets.push_back((v + kNodes / 3) % kNodes);
+            ring.offsets.push_back(ring.targets.size());
+        }
+
+        // the fastest of a few searches
+        PearceSCC<PartitionGraph> scc(ring);
+        double best = 0;
+        for (int round = 0; round < 3; ++round) {
+            scc.Reset();
+            auto start = std::chrono::steady_clock::now();
+            scc.Search(0, [](uint32_t) { return true; },
+                       [](uint32_t, const uint32_t *, const uint32_t *) {});
+            std::chrono::duration<double, std::nano> elapsed =
+                std::chrono::steady_clock::now() - start;
+            if (!round || elapsed.count() < best)
+                best = elapsed.count();
+        }
+        return std::max(best, 1.0) / (kNodes + ring.targets.size());
+    }
+
+    // Whether the work of the partition order_[begin, end), its nodes
+    // plus their out edges, reaches the grain. The out edges bound the
+    // partition's own; counting stops at the grain.
+    bool ReachesGrain(NodeId begin, NodeId end) const {
+        if (grain_ == SIZE_MAX)
+            return false;
+        size_t work = end - begin;
+        for (NodeId i = begin; i < end && work < grain_; ++i) {
+            for (NodeId succ : Traits::Successors(graph_, order_[i])) {
+                (void)succ;
+                ++work;
+            }
+        }
+        return work >= grain_;
+    }
+
+    // Find the loops of the partition order_[begin, end) of color
+    // 'color' by serial searches, as Tarjan's engine does (see
+    // tarjan-loops-inl.h): its SCCs are the loops nested in 'parent',
+    // the SCCs of each one's body without its header the loops nested in
+    // that, and so on down. Each body's SCCs are written back over its
+    // range one after the other, the loops' headers first, for sccs_.
+    void FinishSerially(NodeId begin, NodeId end, Color color, NodeId parent) {
+        NodeId size = end - begin;
+        std::pmr::vector<NodeId> ids(order_.begin() + begin, order_.begin() + end, shared_);
+        for (NodeId v = 0; v < size; ++v)
+            local_[ids[v]] = v;
+
+        // the partition's own graph, by local ids
+        PartitionGraph partition(shared_);
+        partition.offsets.push_back(0);
+        for (NodeId v = 0; v < size; ++v) {
+            for (NodeId succ : Traits::Successors(graph_, ids[v])) {
+                if (GetColor(succ) == color)
+                    partition.targets.push_back(local_[succ]);
+            }
+            partition.offsets.push_back(partition.targets.size());
+        }
+
+        // the body each node is searched in, 0 once its SCC is found
+        struct Body {
+            NodeId begin;
+            NodeId end;
+            NodeId header;
+        };
+        std::pmr::vector<Body> bodies(1, Body{begin, end, parent}, shared_);
+        std::pmr::vector<int> region(size, 0, shared_);
+        int current = 0;
+
+        PearceSCC<PartitionGraph> scc(partition, shared_);
+        scc.Reset();
+        std::pmr::vector<NodeId> members(shared_);
+        std::pmr::vector<NodeId> ends(shared_);
+        while (!bodies.empty()) {
+            Body body = bodies.back();
+            bodies.pop_back();
+
+            ++current;
+            members.clear();
+            for (NodeId i = body.begin; i < body.end; ++i) {
+                NodeId v = local_[order_[i]];
+                region[v] = current;
+                scc.Unvisit(v);
+                members.push_back(v);
+            }
+
+            NodeId out = body.begin;
+            ends.clear();
+            for (NodeId start : members) {
+                if (region[start] != current)
+                    continue;
+                scc.Search(start, [&](NodeId v) { return region[v] == current; },
+                           [&](NodeId, const NodeId *first, const NodeId *last) {
+                               for (const NodeId *v = first; v != last; ++v) {
+                                   region[*v] = 0;
+                                   order_[out++] = ids[*v];
+                               }
+                               ends.push_back(out);
+                           });
+            }
+
+            // SCCs with more than one node or a self-loop are loops
+            NodeId first = body.begin;
+            for (NodeId last : ends) {
+                if (last - first > 1 || HasSelfLoop(order_[first])) {
+                    NodeId *firstNode = &order_[0] + first;
+                    NodeId *lastNode = &order_[0] + last;
+                    NodeId header = sccs_.FindHeader(firstNode, lastNode);
+                    std::iter_swap(firstNode, std::find(firstNode, lastNode, header));
+                    sccs_.Add(first, last, header, body.header);
+                    if (last - first > 1)
+                        bodies.push_back(Body{first + 1, last, header});
+                }
+                first = last;
+            }
+        }
+    }
+
+    Color NewColor() {
+        return nextColor_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Color GetColor(NodeId id) const {
+        return color_[id].load(std::memory_order_relaxed);
+    }
+
+    void SetColor(NodeId id, Color color) {
+        color_[id].store(color, std::memory_order_relaxed);
+    }
+
+    struct HasColor {
+        HasColor(const FWBWLoopFinder *finder, Color color)
+            : finder(finder), color(color) {}
+        bool operator()(NodeId id) const { return finder->GetColor(id) == color; }
+        const FWBWLoopFinder *finder;
+        Color color;
+    };
+
+    // out edges if 'forward', in edges otherwise
+    typename Traits::EdgeRange Neighbors(NodeId id, bool forward) const {
+        return forward ? Traits::Successors(graph_, id) : Traits::Predecessors(graph_, id);
+    }
+
+    bool HasSelfLoop(NodeId id) const {
+        for (NodeId succ : Traits::Successors(graph_, id))
+            if (succ == id)
+                return true;
+        return false;
+    }
+
+    // partitions at least kParallelSize large are trimmed and swept in
+    // parallel, in chunks of kGrain nodes, if the pool has workers
+    static const NodeId kParallelSize = 16 * 1024;
+    static const NodeId kGrain = 4 * 1024;
+    static const NodeId kFrontierGrain = 512;
+
+    bool IsLarge(NodeId begin, NodeId end) const {
+        return end - begin >= kParallelSize && tasks_.pool()->num_workers() > 0;
+    }
+
+    // ParallelFor() grain for a scan over a partition; 0 runs it inline
+    NodeId Grain(NodeId begin, NodeId end) const {
+        return IsLarge(begin, end) ? kGrain : 0;
+    }
+
+    // Drop the nodes of the partition that cannot be on a cycle within
+    // it, and register its isolated 2-cycles as loops. Returns the new
+    // end of the range, which holds the nodes left.
+    //
+    // Trim-1 counts every node's in- and out-edges within the partition
+    // and peels nodes whose count drops to zero from a worklist, in time
+    // linear in the partition's edges. Trim-2 then finds pairs u <-> v
+    // whose only partition predecessor (or successor) is each other:
+    // such a pair is an SCC on its own. Removing it may expose more
+    // trim-1 candidates, so the worklist is drained once more.
+    NodeId Trim(NodeId begin, NodeId end, Color color, NodeId parent, int depth,
+                Pending *pending) {
+        ThreadPool *pool = tasks_.pool();
+        NodeId grain = Grain(begin, end);
+        NodeId *first = &order_[0] + begin;
+
+        // degrees, and the nodes that start out with none
+        std::pmr::vector<std::pmr::vector<NodeId>> zero(NumChunks(end - begin, grain), shared_);
+        ParallelFor(pool, end - begin, grain, [&](size_t chunk, size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; ++i) {
+                NodeId id = first[i];
+                int in = 0;
+                int out = 0;
+                for (NodeId pred : Traits::Predecessors(graph_, id))
+                    in += GetColor(pred) == color;
+                for (NodeId succ : Traits::Successors(graph_, id))
+                    out += GetColor(succ) == color;
+                inDegree_[id].store(in, std::memory_order_relaxed);
+                outDegree_[id].store(out, std::memory_order_relaxed);
+                if (!in || !out)
+                    zero[chunk].push_back(id);
+            }
+        });
+
+        std::pmr::vector<NodeId> worklist(shared_);
+        for (std::pmr::vector<NodeId> &nodes : zero)
+            worklist.insert(worklist.end(), nodes.begin(), nodes.end());
+        DrainTrimList(&worklist, color, grain);
+
+        // trim-2, serially: pairs are rare and the scan is cheap
+        bool havePairs = false;
+        for (NodeId i = begin; i < end; ++i) {
+            NodeId u = order_[i];
+            if (GetColor(u) != color)
+                continue;
+
+            NodeId v = SoleNeighbor(u, color, false);
+            bool closed = v != Traits::kNoNode && SoleNeighbor(v, color, false) == u;
+            if (!closed) {
+                v = SoleNeighbor(u, color, true);
+                closed = v != Traits::kNoNode && SoleNeighbor(v, color, true) == u;
+            }
+            if (!closed)
+                continue;
+
+            // the pair keeps a color of its own, unlike trimmed nodes
+            Color pair = NewColor();
+            Remove(u, color, pair, &worklist);
+            Remove(v, color, pair, &worklist);
+            havePairs = true;
+        }
+        DrainTrimList(&worklist, color, grain);
+
+        // move the nodes left to the front of the range
+        NodeId *last = &order_[0] + end;
+        NodeId *live = std::partition(first, last, HasColor(this, color));
+
+        // gather the pairs behind them, two by two, and record them
+        if (havePairs) {
+            NodeId *pairsEnd = std::partition(live, last, [this](NodeId id) {
+                return GetColor(id) != kNoPartition;
+            });
+            std::sort(live, pairsEnd, [this](NodeId a, NodeId b) {
+                return GetColor(a) < GetColor(b);
+            });
+            for (NodeId *pair = live; pair != pairsEnd; pair += 2)
+                RegisterLoop(pair, pair + 2, parent, depth, pending);
+        }
+        return live - &order_[0];
+    }
+
+    // Remove the nodes in 'worklist' and all nodes whose degree drops to
+    // zero as a consequence, level by level in parallel if grain > 0.
+    void DrainTrimList(std::pmr::vector<NodeId> *worklist, Color color, NodeId grain) {
+        if (!grain) {
+            while (!worklist->empty()) {
+                NodeId id = worklist->back();
+                worklist->pop_back();
+                Remove(id, color, kNoPartition, worklist);
+            }
+            return;
+        }
+
+        while (!worklist->empty()) {
+            std::pmr::vector<std::pmr::vector<NodeId>> next(NumChunks(worklist->size(), grain),
+                                                            shared_);
+            ParallelFor(tasks_.pool(), worklist->size(), grain,
+                        [&](size_t chunk, size_t lo, size_t hi) {
+                            for (size_t i = lo; i < hi; ++i)
+                                Remove((*worklist)[i], color, kNoPartition, &next[chunk]);
+                        });
+            worklist->clear();
+            for (std::pmr::vector<NodeId> &nodes : next)
+                worklist->insert(worklist->end(), nodes.begin(), nodes.end());
+        }
+    }
+
+    // Take node 'id' out of partition 'color' by recoloring it to 'to',
+    // unless it is already out, and lower its neighbors' degrees. Those
+    // left without partition predecessors or successors go to 'zero'.
+    void Remove(NodeId id, Color color, Color to, std::pmr::vector<NodeId> *zero) {
+        Color expected = color;
+        if (!color_[id].compare_exchange_strong(expected, to, std::memory_order_relaxed))
+            return;
+
+        for (NodeId succ : Traits::Successors(graph_, id)) {
+            if (GetColor(succ) == color &&
+                inDegree_[succ].fetch_sub(1, std::memory_order_relaxed) == 1)
+                zero->push_back(succ);
+        }
+        for (NodeId pred : Traits::Predecessors(graph_, id)) {
+            if (GetColor(pred) == color &&
+                outDegree_[pred].fetch_sub(1, std::memory_order_relaxed) == 1)
+                zero->push_back(pred);
+        }
+    }
+
+    // the only partition successor (or predecessor) of a node that has
+    // exactly one partition edge that way, else kNoNode
+    NodeId SoleNeighbor(NodeId id, Color color, bool forward) {
+        const std::atomic<int> *degree = forward ? &outDegree_[id] : &inDegree_[id];
+        if (degree->load(std::memory_order_relaxed) != 1)
+            return Traits::kNoNode;
+
+        for (NodeId neighbor : Neighbors(id, forward)) {
+            if (neighbor != id && GetColor(neighbor) == color)
+                return neighbor;
+        }
+        return Traits::kNoNode;
+    }
+
+    // recolor the nodes reachable from 'start', along out edges if
+    // 'forward' and in edges otherwise, passing only through nodes of
+    // colors 'a' and 'b': those of 'a' get 'toA', those of 'b' 'toB'
+    void Reach(NodeId start, bool forward, Color a, Color toA, Color b, Color toB) {
+        std::pmr::vector<NodeId> stack(shared_);
+
+        SetColor(start, GetColor(start) == a ? toA : toB);
+        stack.push_back(start);
+
+        while (!stack.empty()) {
+            NodeId nodeId = stack.back();
+            stack.pop_back();
+
+            // add neighbors to stack
+            for (NodeId neighborId : Neighbors(nodeId, forward)) {
+                Color c = GetColor(neighborId);
+                if (c == a) {
+                    SetColor(neighborId, toA);
+                    stack.push_back(neighborId);
+                } else if (c == b) {
+                    SetColor(neighborId, toB);
+                    stack.push_back(neighborId);
+                }
+            }
+        }
+    }
+
+    // Direction-optimizing BFS switches to bottom-up steps once the
+    // frontier's edges exceed 1/kAlpha of the edges not yet explored,
+    // and back once the frontier shrinks below 1/kBeta of the partition
+    // (Beamer et al., 2012).
+    static const int kAlpha = 14;
+    static const int kBeta = 24;
+
+    // Recolor a large partition like the two Reach() calls do, but with
+    // both sweeps running at the same time, each a parallel BFS. As the
+    // sweeps cannot both recolor, they mark visit bits and the nodes are
+    // recolored afterwards.
+    void SweepInParallel(NodeId pivot, NodeId begin, NodeId end, Color color,
+                         Color desc, Color pred, Color scc) {
+        TaskGroup sweeps(tasks_.pool());
+        sweeps.Run([&] { Sweep(pivot, begin, end, color, false); });
+        Sweep(pivot, begin, end, color, true);
+        sweeps.Wait();
+
+        ParallelFor(tasks_.pool(), end - begin, kGrain, [&](size_t, size_t lo, size_t hi) {
+            for (size_t i = begin + lo; i < begin + hi; ++i) {
+                NodeId id = order_[i];
+                bool isDesc = descendants_.Get(id);
+                bool isPred = predecessors_.Get(id);
+                if (isDesc)
+                    descendants_.Clear(id);
+                if (isPred)
+                    predecessors_.Clear(id);
+                if (isDesc || isPred)
+                    SetColor(id, isDesc ? (isPred ? scc : desc) : pred);
+            }
+        });
+    }
+
+    // Mark in descendants_ (forward) or predecessors_ (backward) every
+    // node of the partition that is reachable from 'pivot', by a
+    // level-synchronous BFS whose levels are spread over the pool. While
+    // the frontier is narrower than a chunk, as along a chain of SCCs,
+    // levels are not worth their bookkeeping: the search goes on from it
+    // node by node until it widens.
+    void Sweep(NodeId pivot, NodeId begin, NodeId end, Color color, bool forward) {
+        AtomicBitmap &visited = forward ? descendants_ : predecessors_;
+        visited.TestAndSet(pivot);
+
+        // Trim() left the partition degrees in inDegree_ and outDegree_
+        const ScratchArray<std::atomic<int> > &degree = forward ? outDegree_ : inDegree_;
+        int64_t unexplored = 0;
+        for (NodeId i = begin; i < end; ++i)
+            unexplored += degree[order_[i]].load(std::memory_order_relaxed);
+
+        std::pmr::vector<NodeId> frontier(1, pivot, shared_);
+        int64_t frontierEdges = degree[pivot].load(std::memory_order_relaxed);
+        bool bottomUp = false;
+
+        while (!frontier.empty()) {
+            if (!bottomUp && frontier.size() < kFrontierGrain) {
+                size_t head = 0;
+                while (head < frontier.size() && frontier.size() - head < kFrontierGrain) {
+                    NodeId id = frontier[head++];
+                    unexplored -= degree[id].load(std::memory_order_relaxed);
+                    for (NodeId neighborId : Neighbors(id, forward)) {
+                        if (GetColor(neighborId) == color && visited.TestAndSet(neighborId))
+                            frontier.push_back(neighborId);
+                    }
+                }
+                frontier.erase(frontier.begin(), frontier.begin() + head);
+                if (frontier.empty())
+                    break;
+
+                frontierEdges = 0;
+                for (NodeId id : frontier)
+                    frontierEdges += degree[id].load(std::memory_order_relaxed);
+            }
+
+            unexplored -= frontierEdges;
+            if (!bottomUp && frontierEdges > unexplored / kAlpha)
+                bottomUp = true;
+            else if (bottomUp && frontier.size() < (end - begin) / kBeta)
+                bottomUp = false;
+
+            size_t size = bottomUp ? end - begin : frontier.size();
+            size_t grain = bottomUp ? kGrain : kFrontierGrain;
+            std::pmr::vector<std::pmr::vector<NodeId>> next(NumChunks(size, grain), shared_);
+            std::pmr::vector<int64_t> nextEdges(next.size(), 0, shared_);
+
+            ParallelFor(tasks_.pool(), size, grain, [&](size_t chunk, size_t lo, size_t hi) {
+                for (size_t i = lo; i < hi; ++i) {
+                    if (bottomUp) {
+                        // unvisited nodes look for any visited neighbor
+                        // upstream; for reachability it need not be in
+                        // the frontier
+                        NodeId id = order_[begin + i];
+                        if (visited.Get(id))
+                            continue;
+                        for (NodeId neighborId : Neighbors(id, !forward)) {
+                            if (GetColor(neighborId) == color && visited.Get(neighborId)) {
+                                if (visited.TestAndSet(id)) {
+                                    next[chunk].push_back(id);
+                                    nextEdges[chunk] += degree[id].load(std::memory_order_relaxed);
+                                }
+                                break;
+                            }
+                        }
+                    } else {
+                        // frontier nodes push to their neighbors
+                        NodeId id = frontier[i];
+                        for (NodeId neighborId : Neighbors(id, forward)) {
+                            if (GetColor(neighborId) == color && visited.TestAndSet(neighborId)) {
+                                next[chunk].push_back(neighborId);
+                                nextEdges[chunk] += degree[neighborId].load(std::memory_order_relaxed);
+                            }
+                        }
+                    }
+                }
+            });
+
+            frontier.clear();
+            frontierEdges = 0;
+            for (size_t chunk = 0; chunk < next.size(); ++chunk) {
+                frontier.insert(frontier.end(), next[chunk].begin(), next[chunk].end());
+                frontierEdges += nextEdges[chunk];
+            }
+        }
+    }
+
+    // At most one pivot per kNodesPerPivot nodes, and pivots_; partitions
+    // swept in parallel have one.
+    static constexpr int kMaxPivots = 64;
+    static const NodeId kNodesPerPivot = 8;
+
+    int MaxLanes(NodeId begin, NodeId end) const {
+        if (IsLarge(begin, end))
+            return 1;
+        return (int)std::min<NodeId>(pivots_, (end - begin) / kNodesPerPivot);
+    }
+
+    // Lanes for the partitions left by a split of 'size' nodes around
+    // 'lanes' pivots, whose largest SCC has 'largest' nodes. A split
+    // that leaves most of the partition in one SCC does well with few
+    // pivots; more would cross the SCC at different times and each read
+    // its edges once more. One that finds only small SCCs is splitting a
+    // chain of them, which calls for more.
+    static int NextLanes(int lanes, NodeId largest, NodeId size) {
+        if (largest * 2 >= size)
+            return std::max(lanes / 2, 1);
+        return std::min(lanes * 2, kMaxPivots);
+    }
+
+    // The sampled strategy scores kSamplesPerPivot random candidates per
+    // pivot, each by BFS steps forward and backward that stop at
+    // kSampleReach nodes, and keeps the one with the larger lesser reach.
+    static const NodeId kSamplesPerPivot = 4;
+    static const size_t kSampleReach = 32;
+
+    // Random numbers for the random strategies (SplitMix64). The stream
+    // of a partition depends on the seed and its range only, not on the
+    // thread or the order the partitions come up in, so a seed always
+    // gives the same splits.
+    struct Random {
+        Random(uint64_t seed, NodeId begin, NodeId end)
+            : state(seed ^ ((uint64_t)begin << 32 | end)) {}
+
+        uint64_t Next() {
+            uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
+        }
+
+        // uniform in [0, n), near enough for n far below 2^64
+        NodeId Below(NodeId n) { return Next() % n; }
+
+        uint64_t state;
+    };
+
+    // Put the pivots for a split of the partition order_[begin, end) of
+    // color 'color' around 'count' of them into pivots[0, count). Pivot
+    // i is picked, as pivot_ says, from the i-th of 'count' equal slices
+    // of the range: pivots that bunch up in one SCC split off no more
+    // than one of them does.
+    void ChoosePivots(NodeId begin, NodeId end, Color color, int count, NodeId *pivots) {
+        NodeId size = end - begin;
+        Random random(seed_, begin, end);
+        std::pmr::vector<NodeId> seen(shared_);
+
+        for (int i = 0; i < count; ++i) {
+            const NodeId *first = &order_[0] + begin + (uint64_t)i * size / count;
+            const NodeId *last = &order_[0] + begin + (uint64_t)(i + 1) * size / count;
+
+            switch (pivot_) {
+            case kPivotFirst:
+                pivots[i] = *first;
+                break;
+
+            case kPivotDegree:
+                pivots[i] = *std::max_element(first, last, [this](NodeId a, NodeId b) {
+                    return DegreeProduct(a) < DegreeProduct(b);
+                });
+                break;
+
+            case kPivotRandom:
+                pivots[i] = first[random.Below(last - first)];
+                break;
+
+            case kPivotSampled: {
+                size_t best = 0;
+                for (NodeId sample = 0; sample < kSamplesPerPivot; ++sample) {
+                    NodeId candidate = first[random.Below(last - first)];
+                    size_t reach = std::min(SampleReach(candidate, color, true, &seen),
+                                            SampleReach(candidate, color, false, &seen));
+                    if (reach > best) {
+                        best = reach;
+                        pivots[i] = candidate;
+                    }
+                }
+                break;
+            }
+            }
+        }
+    }
+
+    // partition edges into 'id' times those out of it, as Trim() left them
+    uint64_t DegreeProduct(NodeId id) const {
+        return (uint64_t)inDegree_[id].load(std::memory_order_relaxed) *
+               outDegree_[id].load(std::memory_order_relaxed);
+    }
+
+    // Nodes of color 'color' a BFS from 'start' reaches, along out edges
+    // if 'forward' and in edges otherwise, counting up to kSampleReach.
+    // newLanes_, zero outside SearchLanes(), marks the nodes seen.
+    size_t SampleReach(NodeId start, Color color, bool forward, std::pmr::vector<NodeId> *seen) {
+        seen->assign(1, start);
+        newLanes_[start] = 1;
+        for (size_t i = 0; i < seen->size() && seen->size() < kSampleReach; ++i) {
+            for (NodeId neighborId : Neighbors((*seen)[i], forward)) {
+                if (GetColor(neighborId) != color || newLanes_[neighborId])
+                    continue;
+                newLanes_[neighborId] = 1;
+                seen->push_back(neighborId);
+                if (seen->size() == kSampleReach)
+                    break;
+            }
+        }
+        for (NodeId node : *seen)
+            newLanes_[node] = 0;
+        return seen->size();
+    }
+
+    // Split the partition order_[begin, end) of color 'color' around
+    // 'lanes' pivots at once. A multi-source BFS (Then et al., 2014, The
+    // More the Merrier: Efficient Multi-Source Graph Traversal) runs the
+    // forward and the backward search of every pivot in one go, with a
+    // bit lane per pivot: a node's edges are read once per level for all
+    // the lanes that arrive there together, not once per pivot.
+    //
+    // The nodes of an SCC are reached from, and reach, the same pivots.
+    // Grouping the nodes by their two lane masks thus splits the
+    // partition along SCCs: a group whose masks share a lane is the SCC
+    // of that lane's pivot, any other group a partition of its own.
+    void SplitByPivots(NodeId begin, NodeId end, Color color, NodeId parent, int lanes,
+                       int depth, Pending *pending) {
+        NodeId pivots[kMaxPivots];
+        ChoosePivots(begin, end, color, lanes, pivots);
+
+        for (NodeId i = begin; i < end; ++i) {
+            forwardLanes_[order_[i]] = 0;
+            backwardLanes_[order_[i]] = 0;
+        }
+        SearchLanes(pivots, lanes, color, true, forwardLanes_);
+        SearchLanes(pivots, lanes, color, false, backwardLanes_);
+
+        NodeId *first = &order_[0] + begin;
+        NodeId *last = &order_[0] + end;
+        std::sort(first, last, [this](NodeId a, NodeId b) {
+            if (forwardLanes_[a] != forwardLanes_[b])
+                return forwardLanes_[a] < forwardLanes_[b];
+            return backwardLanes_[a] < backwardLanes_[b];
+        });
+
+        NodeId largest = 0;
+        NodeId largestScc = 0;
+        for (NodeId *group = first; group != last;) {
+            NodeId *groupEnd = GroupEnd(group, last);
+            largest = std::max<NodeId>(largest, groupEnd - group);
+            if (forwardLanes_[*group] & backwardLanes_[*group])
+                largestScc = std::max<NodeId>(largestScc, groupEnd - group);
+            group = groupEnd;
+        }
+        RecordSplit(lanes, end - begin, largest);
+        int nextLanes = NextLanes(lanes, largestScc, end - begin);
+
+        for (NodeId *group = first; group != last;) {
+            NodeId *groupEnd = GroupEnd(group, last);
+            Color groupColor = NewColor();
+            for (NodeId *node = group; node != groupEnd; ++node)
+                SetColor(*node, groupColor);
+
+            if (!(forwardLanes_[*group] & backwardLanes_[*group])) {
+                ProcessPartition(Partition{NodeId(group - &order_[0]),
+                                           NodeId(groupEnd - &order_[0]), groupColor,
+                                           parent, nextLanes, depth + 1}, pending);
+            } else if (groupEnd - group > 1 || HasSelfLoop(*group)) {
+                RegisterLoop(group, groupEnd, parent, depth, pending);
+            }
+            group = groupEnd;
+        }
+    }
+
+    // end of the group of nodes with the lane masks of *group
+    NodeId *GroupEnd(NodeId *group, NodeId *last) const {
+        NodeId *node = group + 1;
+        while (node != last && forwardLanes_[*node] == forwardLanes_[*group] &&
+               backwardLanes_[*node] == backwardLanes_[*group])
+            ++node;
+        return node;
+    }
+
+    // Multi-source BFS through the nodes of color 'color', along out
+    // edges if 'forward' and in edges otherwise: sets bit i of 'reached'
+    // for every node pivots[i], i < count, reaches, itself included.
+    // newLanes_ gathers the lanes that arrive at a node in one level.
+    void SearchLanes(const NodeId *pivots, int count, Color color, bool forward,
+                     ScratchArray<uint64_t> &reached) {
+        struct Visit {
+            NodeId node;
+            uint64_t lanes;
+        };
+        std::pmr::vector<Visit> frontier(shared_);
+        std::pmr::vector<NodeId> next(shared_);
+        for (int lane = 0; lane < count; ++lane) {
+            uint64_t bit = uint64_t(1) << lane;
+            reached[pivots[lane]] |= bit;
+            frontier.push_back(Visit{pivots[lane], bit});
+        }
+
+        while (!frontier.empty()) {
+            for (const Visit &visit : frontier) {
+                for (NodeId neighborId : Neighbors(visit.node, forward)) {
+                    if (GetColor(neighborId) != color)
+                        continue;
+                    uint64_t lanes = visit.lanes & ~reached[neighborId];
+                    if (!lanes)
+                        continue;
+                    if (!newLanes_[neighborId])
+                        next.push_back(neighborId);
+                    newLanes_[neighborId] |= lanes;
+                    reached[neighborId] |= lanes;
+                }
+            }
+
+            frontier.clear();
+            for (NodeId node : next) {
+                frontier.push_back(Visit{node, newLanes_[node]});
+                newLanes_[node] = 0;
+            }
+            next.clear();
+        }
+    }
+
+    // a split of a partition of 'size' nodes around 'lanes' pivots, whose
+    // largest part kept 'largest' nodes
+    void RecordSplit(int lanes, NodeId size, NodeId largest) {
+        splits_.fetch_add(1, std::memory_order_relaxed);
+        pivotsSearched_.fetch_add(lanes, std::memory_order_relaxed);
+        splitNodes_.fetch_add(size, std::memory_order_relaxed);
+        largestNodes_.fetch_add(largest, std::memory_order_relaxed);
+    }
+
+    void RecordDepth(int depth) {
+        int deepest = depth_.load(std::memory_order_relaxed);
+        while (depth > deepest &&
+               !depth_.compare_exchange_weak(deepest, depth, std::memory_order_relaxed)) {
+        }
+    }
+
+    void ReportStats() const {
+        if (!stats_)
+            return;
+        stats_->pivot = pivot_;
+        stats_->splits = splits_.load(std::memory_order_relaxed);
+        stats_->pivots = pivotsSearched_.load(std::memory_order_relaxed);
+        stats_->splitNodes = splitNodes_.load(std::memory_order_relaxed);
+        stats_->largestNodes = largestNodes_.load(std::memory_order_relaxed);
+        stats_->depth = depth_.load(std::memory_order_relaxed);
+        stats_->grain = grain_;
+        stats_->tasks = tasksRun_.load(std::memory_order_relaxed);
+        stats_->serial = serialRun_.load(std::memory_order_relaxed);
+    }
+
+    const Graph &graph_;                            // the control flow graph
+    LoopStructureGraph *lsg_;                       // loop forest
+    std::pmr::memory_resource *shared_;             // scratch of the partitions
+    ScratchArray<std::atomic<Color> > color_;       // partition of each node
+    std::pmr::vector<NodeId> order_;                // nodes, grouped by partition
+    ScratchArray<std::atomic<int> > inDegree_;      // partition edges into each node,
+    ScratchArray<std::atomic<int> > outDegree_;     // and out of it, while trimming
+    std::atomic<Color> nextColor_;                  // next unused color
+    AtomicBitmap descendants_;                      // reached by the forward sweep
+    AtomicBitmap predecessors_;                     // reached by the backward sweep
+    int pivots_;                                    // most pivots per split
+    ScratchArray<uint64_t> forwardLanes_;           // pivots reaching each node,
+    ScratchArray<uint64_t> backwardLanes_;          // and reached from it, by lane
+    ScratchArray<uint64_t> newLanes_;               // lanes of the next BFS level
+    FWBWPivot pivot_;                               // how pivots are picked,
+    uint64_t seed_;                                 // and the random seed
+    size_t grain_;                                  // least work run as a task
+    bool serial_;                                   // finish the rest serially
+    ScratchArray<NodeId> local_;                    // id in its serial partition
+    FWBWStats *stats_;                              // receives the counts below, or NULL
+    std::atomic<uint64_t> splits_;                  // partitions split,
+    std::atomic<uint64_t> pivotsSearched_;          // the pivots searched from,
+    std::atomic<uint64_t> splitNodes_;              // the nodes of the partitions,
+    std::atomic<uint64_t> largestNodes_;            // those of the largest parts,
+    std::atomic<int> depth_;                        // the deepest partition,
+    std::atomic<uint64_t> tasksRun_;                // partitions run as tasks,
+    std::atomic<uint64_t> serialRun_;               // and finished serially
+
+    SccRecords<Graph> sccs_;                               // loops found so far
+    TaskGroup tasks_;                               // partitions queued on the pool
+};
+
+// FWBW Trim algorithm on any graph with GraphTraits, read in place
+template <typename Graph>
+int FindFWBWLoopsIn(const Graph &graph, LoopStructureGraph *LSG,
+                    const FWBWOptions &options = FWBWOptions()) {
+    FWBWLoopFinder<Graph> finder(graph, LSG, options, BeginScratch(options.workspace),
+                                 SharedScratch(options.workspace));
+    finder.FindLoops();
+    return LSG->GetNumLoops();
+}
+
+#endif // FWBW_LOOPS_INL_H_
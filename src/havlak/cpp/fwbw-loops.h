@@ -1,12 +1,97 @@
 #ifndef FWBW_LOOPS_H_
 #define FWBW_LOOPS_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "mao-loops.h"
+#include "thread-pool.h"
 
-// forward declaration of the FWBWLoopFinder class
+// forward declaration of the FWBWLoopFinder class template, which
+// fwbw-loops-inl.h defines for any graph with GraphTraits
+template <typename Graph>
 class FWBWLoopFinder;
 
+// How FWBW picks the pivots a partition is split around. Several
+// pivots are each picked from their own slice of the partition.
+enum FWBWPivot {
+    kPivotFirst,   // the first node of the partition's range; on a chain
+                   // of SCCs that is mostly one end of it, and a single
+                   // pivot then peels off one SCC per split
+    kPivotDegree,  // the node with the most partition edges in times out
+    kPivotRandom,  // a uniformly random node, from FWBWOptions::seed
+    kPivotSampled, // of a few random candidates, the one that reaches the
+                   // most nodes, and is reached by the most, within a
+                   // few BFS steps
+};
+
+// "first", "degree", ...
+const char *FWBWPivotName(FWBWPivot pivot);
+
+// what the splits of one FindFWBWLoops() call did
+struct FWBWStats {
+    FWBWPivot pivot;       // strategy that picked the pivots
+    uint64_t splits;       // partitions split around pivots
+    uint64_t pivots;       // pivots searched from
+    uint64_t splitNodes;   // nodes of the partitions split, after trimming
+    uint64_t largestNodes; // nodes of the largest part each split left
+    int depth;             // most splits above a partition
+    size_t grain;          // FWBWOptions::grain, or the one derived
+    uint64_t tasks;        // partitions run as tasks,
+    uint64_t serial;       // and those finished by the serial search
+
+    // The share of the nodes of a split partition that its largest part
+    // keeps, overall: near 1 when splits peel off little, as around one
+    // end of a chain, lower the better they balance.
+    double Imbalance() const {
+        return splitNodes ? (double)largestNodes / splitNodes : 0;
+    }
+};
+
+// tuning knobs for the FWBW engine
+struct FWBWOptions {
+    // pool running the partitions; the calling thread helps out while
+    // it waits. NULL means ThreadPool::Default().
+    ThreadPool *pool = nullptr;
+
+    // scratch memory for the calling thread's arrays (see
+    // loop-workspace.h); NULL uses the heap
+    LoopAnalysisWorkspace *workspace = nullptr;
+
+    // pivots a partition is split around at once, each searched from in
+    // a bit lane of one multi-source BFS (see fwbw-loops-inl.h); 1 to 64.
+    // 1 splits around a single pivot, as the classic algorithm does.
+    int pivots = 64;
+
+    // how the pivots are picked, and the seed of the random strategies
+    FWBWPivot pivot = kPivotRandom;
+    uint64_t seed = 1;
+
+    // Partitions estimated to take less work than this, in nodes plus
+    // edges, are not worth a task: they run on the thread that split
+    // them off. 0 derives it from the pool, as the work the serial search
+    // does in the time the pool takes to run a few tasks, and at least
+    // in the time it takes to run one (see ThreadPool::TaskOverhead()).
+    size_t grain = 0;
+
+    // whether partitions below the grain are finished by a serial SCC
+    // search, as Tarjan's algorithm does, instead of split further. With
+    // no workers in the pool every partition is, so the whole graph goes
+    // to the serial search.
+    bool serial = true;
+
+    // receives the statistics of the splits; NULL skips them
+    FWBWStats *stats = nullptr;
+};
+
 // entry point for FWBW Trim algorithm
 int FindFWBWLoops(MaoCFG *CFG, LoopStructureGraph *LSG);
 
+// same, running directly on a frozen CSR snapshot
+int FindFWBWLoops(const CSRGraph &graph, LoopStructureGraph *LSG);
+
+// same, with explicit options
+int FindFWBWLoops(const CSRGraph &graph, LoopStructureGraph *LSG,
+                  const FWBWOptions &options);
+
 #endif // FWBW_LOOPS_H_
@@ -0,0 +1,75 @@
+#ifndef GRAPH_TRAITS_H_
+#define GRAPH_TRAITS_H_
+
+#include "csr-graph.h"
+
+// GraphTraits
+//
+// How the templated loop finders (mao-loops-inl.h, tarjan-loops-inl.h,
+// fwbw-loops-inl.h) see a control flow graph, so that they can run on a
+// compiler's own CFG instead of a copy of it. A specialization for a
+// graph type G provides:
+//
+//   typedef ... NodeId;                 unsigned integer; the nodes are
+//                                       0 .. NumNodes() - 1
+//   typedef ... EdgeIterator;           iterator yielding NodeIds
+//   typedef ... EdgeRange;              begin() and end() EdgeIterators
+//   static const NodeId kNoNode;        larger than any node
+//
+//   static NodeId NumNodes(const G &g);
+//   static NodeId StartNode(const G &g);               kNoNode if empty
+//   static EdgeRange Successors(const G &g, NodeId v);
+//   static EdgeRange Predecessors(const G &g, NodeId v);
+//   static BasicBlock *Block(const G &g, NodeId v);
+//
+// Successors and predecessors are visited in the order given, which
+// decides the DFS numbering and with it the headers of irreducible
+// loops. Block() is only asked for the loops' headers and members, to
+// record them in the LoopStructureGraph.
+//
+// The finders keep per-node state in arrays indexed by NodeId, and call
+// the traits from their inner loops: specializations should be inline.
+// The stock ones are GraphTraits<CSRGraph>, below, and GraphTraits<MaoCFG>
+// in mao-loops.h.
+//
+template <typename G>
+struct GraphTraits;
+
+// [begin, end) over any iterator, for adapters whose edge lists are not
+// NodeId arrays
+template <typename Iterator>
+class IteratorRange {
+public:
+    IteratorRange(Iterator begin, Iterator end) : begin_(begin), end_(end) {}
+
+    Iterator begin() const { return begin_; }
+    Iterator end() const { return end_; }
+    bool empty() const { return begin_ == end_; }
+
+private:
+    Iterator begin_, end_;
+};
+
+template <>
+struct GraphTraits<CSRGraph> {
+    typedef CSRGraph::NodeId NodeId;
+    typedef const NodeId *EdgeIterator;
+    typedef CSRGraph::NodeRange EdgeRange;
+
+    static constexpr NodeId kNoNode = CSRGraph::kNoNode;
+
+    static NodeId NumNodes(const CSRGraph &g) { return g.GetNumNodes(); }
+    static NodeId StartNode(const CSRGraph &g) { return g.start_node(); }
+
+    static EdgeRange Successors(const CSRGraph &g, NodeId v) {
+        return g.out_edges(v);
+    }
+
+    static EdgeRange Predecessors(const CSRGraph &g, NodeId v) {
+        return g.in_edges(v);
+    }
+
+    static BasicBlock *Block(const CSRGraph &g, NodeId v) { return g.block(v); }
+};
+
+#endif // GRAPH_TRAITS_H_
@@ -0,0 +1,45 @@
+#include <stdio.h>
+
+#include "loop-workspace.h"
+#include "mao-loops.h"
+
+void *LoopAnalysisWorkspace::Overflow::do_allocate(size_t bytes, size_t alignment) {
+    bytes_ += bytes;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void LoopAnalysisWorkspace::Overflow::do_deallocate(void *p, size_t bytes, size_t alignment) {
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+}
+
+bool LoopAnalysisWorkspace::Overflow::do_is_equal(
+    const std::pmr::memory_resource &other) const noexcept {
+    return this == &other;
+}
+
+LoopAnalysisWorkspace::LoopAnalysisWorkspace()
+    : capacity_(0), arena_(new std::pmr::monotonic_buffer_resource(&overflow_)) {
+}
+
+LoopAnalysisWorkspace::~LoopAnalysisWorkspace() {
+}
+
+std::pmr::memory_resource *LoopAnalysisWorkspace::Begin() {
+    arena_->release();
+
+    // the last call overflowed: the buffer grows by what it took from
+    // the heap, which is at least what it lacked
+    if (overflow_.bytes()) {
+        capacity_ += overflow_.bytes();
+        overflow_.ResetBytes();
+        buffer_.reset(new char[capacity_]);
+        arena_.reset(new std::pmr::monotonic_buffer_resource(buffer_.get(), capacity_,
+                                                             &overflow_));
+    }
+    return arena_.get();
+}
+
+const CSRGraph &LoopAnalysisWorkspace::Snapshot(MaoCFG *cfg) {
+    cfg->BuildSnapshot(&snapshot_);
+    return snapshot_;
+}
@@ -0,0 +1,86 @@
+#ifndef LOOP_WORKSPACE_H_
+#define LOOP_WORKSPACE_H_
+
+#include <stddef.h>
+#include <memory>
+#include <memory_resource>
+
+#include "csr-graph.h"
+
+class MaoCFG;
+
+// LoopAnalysisWorkspace
+//
+// Scratch memory for the loop finders, kept from one call to the next.
+// A finder handed a workspace takes its temporary containers from a
+// std::pmr monotonic buffer the workspace owns, and the next call
+// rewinds that buffer instead of going back to the heap. A call that
+// outgrows the buffer gets the rest from the heap, and the buffer is
+// enlarged to that high-water mark before the following call, so
+// repeated analyses of similar graphs settle into doing no scratch
+// allocation at all. Snapshot() likewise rebuilds one CSRGraph in place.
+//
+// A workspace serves one call at a time: keep one per thread. The
+// monotonic buffer is for the calling thread only; the tasks of the
+// parallel engines take their scratch from shared(), a thread-safe pool
+// that keeps the blocks freed by one call for the next.
+//
+class LoopAnalysisWorkspace {
+public:
+    LoopAnalysisWorkspace();
+    ~LoopAnalysisWorkspace();
+
+    // Start a new call: drop everything taken from the workspace so far
+    // and return the memory resource for the call's scratch.
+    std::pmr::memory_resource *Begin();
+
+    // Thread-safe resource for scratch allocated by pool tasks.
+    std::pmr::memory_resource *shared() { return &shared_; }
+
+    // Snapshot of 'cfg', reusing the storage of the previous one.
+    const CSRGraph &Snapshot(MaoCFG *cfg);
+
+    // bytes of the buffer a call can use without touching the heap
+    size_t capacity() const { return capacity_; }
+
+private:
+    // heap memory the buffer overflows into, counted
+    class Overflow : public std::pmr::memory_resource {
+    public:
+        Overflow() : bytes_(0) {}
+
+        size_t bytes() const { return bytes_; }
+        void ResetBytes() { bytes_ = 0; }
+
+    private:
+        void *do_allocate(size_t bytes, size_t alignment) override;
+        void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+        size_t bytes_;
+    };
+
+    LoopAnalysisWorkspace(const LoopAnalysisWorkspace &);
+    LoopAnalysisWorkspace &operator=(const LoopAnalysisWorkspace &);
+
+    Overflow overflow_;
+    std::unique_ptr<char[]> buffer_;
+    size_t capacity_;
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> arena_;
+    std::pmr::synchronized_pool_resource shared_;
+    CSRGraph snapshot_;
+};
+
+// The resource of a new call on 'workspace', or the default (heap) one
+// if it is null.
+inline std::pmr::memory_resource *BeginScratch(LoopAnalysisWorkspace *workspace) {
+    return workspace ? workspace->Begin() : std::pmr::get_default_resource();
+}
+
+// The resource for task scratch of a call on 'workspace', or the default
+// one if it is null.
+inline std::pmr::memory_resource *SharedScratch(LoopAnalysisWorkspace *workspace) {
+    return workspace ? workspace->shared() : std::pmr::get_default_resource();
+}
+
+#endif // LOOP_WORKSPACE_H_
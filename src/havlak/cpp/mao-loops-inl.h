@@ -0,0 +1,436 @@
+// Copyright 2011 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MAO_LOOPS_INL_H_
+#define MAO_LOOPS_INL_H_
+
+#include <list>
+#include <memory_resource>
+#include <set>
+#include <vector>
+#include <algorithm>
+
+#include "graph-traits.h"
+#include "loop-workspace.h"
+#include "mao-loops.h"
+#include "union-find.h"
+
+//======================================================
+// Main Algorithm
+//======================================================
+
+//------------------------------------------------------------------
+// Loop Recognition
+//
+// based on:
+//   Paul Havlak, Nesting of Reducible and Irreducible Loops,
+//      Rice University.
+//
+//   The collapsed loop bodies are kept in a UnionFind over DFS
+//   numbers (path halving, union by rank), with a side array naming
+//   the header each set has been collapsed into.
+//
+//   All containers draw from one std::pmr memory resource, which is
+//   a LoopAnalysisWorkspace's buffer if the caller passes one.
+//
+//   'Graph' is any graph with GraphTraits (see graph-traits.h); the
+//   finder reads it in place.
+//
+//   Most of the variable names and identifiers are taken literally
+//   from this paper (and the original Tarjan paper mentioned above).
+//-------------------------------------------------------------------
+template <typename Graph>
+class HavlakLoopFinder {
+ public:
+  HavlakLoopFinder(const Graph &graph, LoopStructureGraph *lsg,
+                   bool recursive_dfs = false,
+                   std::pmr::memory_resource *memory =
+                       std::pmr::get_default_resource()) :
+    graph_(graph), lsg_(lsg), recursive_dfs_(recursive_dfs),
+    memory_(memory), sets_(memory), set_header_(memory) {
+  }
+
+  enum BasicBlockClass {
+    BB_TOP,          // uninitialized
+    BB_NONHEADER,    // a regular BB
+    BB_REDUCIBLE,    // reducible loop
+    BB_SELF,         // single BB loop
+    BB_IRREDUCIBLE,  // irreducible loop
+    BB_DEAD,         // a dead BB
+    BB_LAST          // Sentinel
+  };
+
+  //
+  // Constants
+  //
+  // Marker for uninitialized nodes.
+  static const int kUnvisited = -1;
+  // Safeguard against pathologic algorithm behavior.
+  static const int kMaxNonBackPreds = (32*1024);
+
+  //
+  // Local types used for Havlak algorithm, all carefully
+  // selected to guarantee minimal complexity.
+  //
+  typedef GraphTraits<Graph>                  Traits;
+  typedef typename Traits::NodeId             NodeId;
+  typedef std::pmr::list<int>                 IntList;
+  typedef std::pmr::set<int>                  IntSet;
+  typedef std::pmr::vector<IntList>           IntListVector;
+  typedef std::pmr::vector<IntSet>            IntSetVector;
+  typedef std::pmr::vector<int>               IntVector;
+  typedef std::pmr::vector<char>              CharVector;
+  typedef std::pmr::vector<SimpleLoop*>       LoopVector;
+
+  //
+  // IsAncestor
+  //
+  // As described in the paper, determine whether a node 'w' is a
+  // "true" ancestor for node 'v'.
+  //
+  // Dominance can be tested quickly using a pre-order trick
+  // for depth-first spanning trees. This is why DFS is the first
+  // thing we run below.
+  //
+  bool IsAncestor(int w, int v, IntVector *last) {
+    return ((w <= v) && (v <= (*last)[w]));
+  }
+
+  //
+  // FindSet
+  //
+  // Union/Find - the header of the loop body that node v (a DFS
+  // number) has been collapsed into so far, or v itself.
+  //
+  int FindSet(int v) {
+    return set_header_[sets_.Find(v)];
+  }
+
+  //
+  // Union
+  //
+  // Union/Find - collapse the set of node v into the loop headed by w.
+  //
+  void Union(int v, int w) {
+    set_header_[sets_.Union(v, w)] = w;
+  }
+
+  //
+  // DFS - Depth-First-Search
+  //
+  // DESCRIPTION:
+  // Depth first traversal along out edges with node numbering.
+  // 'number' maps dense node ids to preorder numbers, 'vertex' maps
+  // preorder numbers back to node ids.
+  //
+  // The recursion is replaced by an explicit stack of frames, each
+  // holding a node and its next unexplored out-edge. The stack is
+  // reserved for the worst case (a single chain) up front, so numbering
+  // does no per-node allocation and its depth is bounded by memory, not
+  // by the thread's stack. Numbers and 'last' are identical to the ones
+  // DFSRecursive produces.
+  //
+  int DFS(NodeId          start_node,
+          IntVector       *number,
+          IntVector       *vertex,
+          IntVector       *last) {
+    struct Frame {
+      NodeId         node;
+      typename Traits::EdgeIterator next_edge;
+      typename Traits::EdgeIterator end_edge;
+    };
+    std::pmr::vector<Frame> stack(memory_);
+    stack.reserve(Traits::NumNodes(graph_));
+
+    int lastid = 0;
+    (*number)[start_node] = 0;
+    (*vertex)[0] = start_node;
+    typename Traits::EdgeRange edges = Traits::Successors(graph_, start_node);
+    Frame root = { start_node, edges.begin(), edges.end() };
+    stack.push_back(root);
+
+    while (!stack.empty()) {
+      Frame &top = stack.back();
+      if (top.next_edge == top.end_edge) {
+        (*last)[(*number)[top.node]] = lastid;
+        stack.pop_back();
+        continue;
+      }
+
+      NodeId target = *top.next_edge++;
+      if ((*number)[target] != kUnvisited)
+        continue;
+
+      ++lastid;
+      (*number)[target] = lastid;
+      (*vertex)[lastid] = target;
+      edges = Traits::Successors(graph_, target);
+      Frame frame = { target, edges.begin(), edges.end() };
+      stack.push_back(frame);
+    }
+    return lastid;
+  }
+
+  //
+  // DFSRecursive
+  //
+  // DESCRIPTION:
+  // The original recursive formulation of DFS above, one native stack
+  // frame per tree level. Kept as the benchmark baseline.
+  //
+  int DFSRecursive(NodeId          current_node,
+                   IntVector       *number,
+                   IntVector       *vertex,
+                   IntVector       *last,
+                   const int       current) {
+    (*number)[current_node] = current;
+    (*vertex)[current] = current_node;
+
+    int lastid = current;
+    for (NodeId target : Traits::Successors(graph_, current_node)) {
+      if ((*number)[target] == kUnvisited)
+        lastid = DFSRecursive(target, number, vertex, last, lastid + 1);
+    }
+    (*last)[(*number)[current_node]] = lastid;
+    return lastid;
+  }
+
+  //
+  // FindLoops
+  //
+  // Find loops and build loop forest using Havlak's algorithm, which
+  // is derived from Tarjan. Variable names and step numbering has
+  // been chosen to be identical to the nomenclature in Havlak's
+  // paper (which is similar to the one used by Tarjan).
+  //
+  void FindLoops() {
+    if (Traits::StartNode(graph_) == Traits::kNoNode) return;
+
+    int                size = Traits::NumNodes(graph_);
+
+    // the elements of the vectors of sets and lists take the memory
+    // resource from the vector
+    IntSetVector       non_back_preds(size, memory_);
+    IntListVector      back_preds(size, memory_);
+    IntVector          header(size, memory_);
+    CharVector         type(size, memory_);
+    IntVector          last(size, memory_);
+    IntVector          number(size, kUnvisited, memory_);
+    IntVector          vertex(size, kUnvisited, memory_);
+    LoopVector         loops(size, memory_);  // loop headed by each node, if any
+
+    sets_.Reset(size);
+    set_header_.resize(size);
+    for (int w = 0; w < size; w++)
+      set_header_[w] = w;
+
+    // Step a:
+    //   - initialize all nodes as unvisited.
+    //   - depth-first traversal and numbering.
+    //   - unreached BB's are marked as dead.
+    //
+    if (recursive_dfs_)
+      DFSRecursive(Traits::StartNode(graph_), &number, &vertex, &last, 0);
+    else
+      DFS(Traits::StartNode(graph_), &number, &vertex, &last);
+
+    // Step b:
+    //   - iterate over all nodes.
+    //
+    //   A backedge comes from a descendant in the DFS tree, and non-backedges
+    //   from non-descendants (following Tarjan).
+    //
+    //   - check incoming edges 'v' and add them to either
+    //     - the list of backedges (back_preds) or
+    //     - the list of non-backedges (non_back_preds)
+    //
+    for (int w = 0; w < size; w++) {
+      header[w] = 0;
+      type[w] = BB_NONHEADER;
+
+      if (vertex[w] == kUnvisited) {
+        type[w] = BB_DEAD;
+        continue;  // dead BB
+      }
+
+      for (NodeId node_v : Traits::Predecessors(graph_, vertex[w])) {
+        int v = number[ node_v ];
+        if (v == kUnvisited) continue;  // dead node
+
+        if (IsAncestor(w, v, &last))
+          back_preds[w].push_back(v);
+        else
+          non_back_preds[w].insert(v);
+      }
+    }
+
+    // Start node is root of all other loops.
+    header[0] = 0;
+
+    // Step c:
+    //
+    // The outer loop, unchanged from Tarjan. It does nothing except
+    // for those nodes which are the destinations of backedges.
+    // For a header node w, we chase backward from the sources of the
+    // backedges adding nodes to the set P, representing the body of
+    // the loop headed by w.
+    //
+    // By running through the nodes in reverse of the DFST preorder,
+    // we ensure that inner loop headers will be processed before the
+    // headers for surrounding loops.
+    //
+    for (int w = size-1; w >= 0; w--) {
+      IntList node_pool(memory_);  // this is 'P' in Havlak's paper
+      if (vertex[w] == kUnvisited) continue;  // dead BB
+
+      // Step d:
+      IntList::iterator back_pred_iter  = back_preds[w].begin();
+      IntList::iterator back_pred_end   = back_preds[w].end();
+      for (; back_pred_iter != back_pred_end; back_pred_iter++) {
+        int v = *back_pred_iter;
+        if (v != w)
+          node_pool.push_back(FindSet(v));
+        else
+          type[w] = BB_SELF;
+      }
+
+      // Copy node_pool to worklist.
+      //
+      IntList worklist(memory_);
+      IntList::iterator niter  = node_pool.begin();
+      IntList::iterator nend   = node_pool.end();
+      for (;  niter != nend; ++niter)
+        worklist.push_back(*niter);
+
+      if (!node_pool.empty())
+        type[w] = BB_REDUCIBLE;
+
+      // work the list...
+      //
+      while (!worklist.empty()) {
+        int x = worklist.front();
+        worklist.pop_front();
+
+        // Step e:
+        //
+        // Step e represents the main difference from Tarjan's method.
+        // Chasing upwards from the sources of a node w's backedges. If
+        // there is a node y' that is not a descendant of w, w is marked
+        // the header of an irreducible loop, there is another entry
+        // into this loop that avoids w.
+        //
+
+        // The algorithm has degenerated. Break and
+        // return in this case.
+        //
+        size_t non_back_size = non_back_preds[x].size();
+        if (non_back_size > kMaxNonBackPreds) {
+          lsg_->KillAll();
+          return;
+        }
+
+        IntSet::iterator non_back_pred_iter =
+          non_back_preds[x].begin();
+        IntSet::iterator non_back_pred_end  =
+          non_back_preds[x].end();
+        for (; non_back_pred_iter != non_back_pred_end; non_back_pred_iter++) {
+          int ydash = FindSet(*non_back_pred_iter);
+
+          if (!IsAncestor(w, ydash, &last)) {
+            type[w] = BB_IRREDUCIBLE;
+            non_back_preds[w].insert(ydash);
+          } else {
+            if (ydash != w) {
+              IntList::iterator nfind = find(node_pool.begin(),
+                                             node_pool.end(), ydash);
+              if (nfind == node_pool.end()) {
+                worklist.push_back(ydash);
+                node_pool.push_back(ydash);
+              }
+            }
+          }
+        }
+      }
+
+      // Collapse/Unionize nodes in a SCC to a single node
+      // For every SCC found, create a loop descriptor and link it in.
+      //
+      if (!node_pool.empty() || (type[w] == BB_SELF)) {
+        SimpleLoop* loop = lsg_->CreateNewLoop();
+
+        // At this point, one can set attributes to the loop, such as:
+        //
+        // the bottom node:
+        //    IntList::iterator iter  = back_preds[w].begin();
+        //    loop bottom is: Traits::Block(graph_, vertex[*iter]);
+        //
+        // the number of backedges:
+        //    back_preds[w].size()
+        //
+        // whether this loop is reducible:
+        //    type[w] != BB_IRREDUCIBLE
+        //
+        // TODO(rhundt): Define those interfaces in the Loop Forest.
+        //
+        loops[w] = loop;
+        loop->set_header(Traits::Block(graph_, vertex[w]));
+
+        for (niter = node_pool.begin(); niter != node_pool.end(); niter++) {
+          int node = *niter;
+
+          // Add nodes to loop descriptor.
+          header[node] = w;
+          Union(node, w);
+
+          // Nested loops are not added, but linked together.
+          if (loops[node])
+            loops[node]->set_parent(loop);
+          else
+            loop->AddNode(Traits::Block(graph_, vertex[node]));
+        }
+
+        lsg_->AddLoop(loop);
+      }  // node_pool.size
+    }  // Step c
+  }  // FindLoops
+
+ private:
+  const Graph        &graph_;    // the control flow graph.
+  LoopStructureGraph *lsg_;      // loop forest.
+  bool                recursive_dfs_;  // number with DFSRecursive.
+  std::pmr::memory_resource *memory_;  // scratch for all containers.
+  UnionFind<int>      sets_;     // collapsed loop bodies, by DFS number.
+  IntVector           set_header_;  // header naming each set, by representative.
+};  // HavlakLoopFinder
+
+
+// Constant instantiations.
+//
+template <typename Graph>
+const int HavlakLoopFinder<Graph>::kUnvisited;
+template <typename Graph>
+const int HavlakLoopFinder<Graph>::kMaxNonBackPreds;
+
+// Havlak's algorithm on any graph with GraphTraits, read in place; the
+// scratch memory is taken from 'workspace' (see loop-workspace.h), or
+// the heap if it is NULL.
+template <typename Graph>
+int FindHavlakLoopsIn(const Graph &graph, LoopStructureGraph *LSG,
+                      LoopAnalysisWorkspace *workspace = NULL) {
+  HavlakLoopFinder<Graph> finder(graph, LSG, false, BeginScratch(workspace));
+  finder.FindLoops();
+  return LSG->GetNumLoops();
+}
+
+#endif  // MAO_LOOPS_INL_H_
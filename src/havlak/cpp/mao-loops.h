@@ -15,14 +15,23 @@
 #ifndef MAO_LOOPS_H_
 #define MAO_LOOPS_H_
 
+#include <stdint.h>
 #include <algorithm>
+#include <iterator>
 #include <list>
 #include <map>
 #include <set>
+#include <unordered_map>
 #include <vector>
 
+#include "arena.h"
+#include "csr-graph.h"
+#include "graph-traits.h"
+
 // Forward Decls
 class BasicBlock;
+class LoopAnalysisWorkspace;
+class LoopStructureGraph;
 class MaoCFG;
 
 //--- MOCKING CODE begin -------------------
@@ -32,6 +41,9 @@ class MaoCFG;
 //
 // BasicBlockEdge only maintains two pointers to BasicBlocks.
 //
+// Edges built with 'new' are owned and deleted by the MaoCFG they are
+// added to; MaoCFG::CreateEdge() places them in the CFG's arena instead.
+//
 class BasicBlockEdge {
 public:
     inline BasicBlockEdge(MaoCFG *cfg, int from, int to);
@@ -40,19 +52,26 @@ public:
     BasicBlock *GetDst() { return to_; }
 
 private:
+    friend class MaoCFG;
+
+    inline BasicBlockEdge(BasicBlock *from, BasicBlock *to);
+
     BasicBlock *from_, *to_;
 };
 
 // BasicBlock only maintains a vector of in-edges and
-// a vector of out-edges.
+// a vector of out-edges, plus its dense index in the owning MaoCFG.
 //
 class BasicBlock {
 public:
     typedef std::vector<BasicBlock *> EdgeVector;
 
-    explicit BasicBlock(int name) : name_(name) {
+    BasicBlock(int name, int index) : name_(name), index_(index) {
     }
 
+    int name() const { return name_; }
+    int index() const { return index_; }
+
     EdgeVector *in_edges() { return &in_edges_; }
     EdgeVector *out_edges() { return &out_edges_; }
 
@@ -65,22 +84,39 @@ public:
 private:
     EdgeVector in_edges_, out_edges_;
     int name_;
+    int index_;
 };
 
-// MaoCFG maintains a list of nodes.
+// MaoCFG maintains a vector of nodes, indexed by BasicBlock::index().
+//
+// Nodes are numbered densely in creation order. Block names that are
+// small non-negative integers, as the CFG builders produce, are looked up
+// through a table indexed by name; any other name goes to a hash map.
+//
+// Blocks and CreateEdge() edges are carved out of an arena owned by the
+// CFG and released in bulk when it is destroyed.
 //
 class MaoCFG {
 public:
-    typedef std::map<int, BasicBlock *> NodeMap;
+    typedef std::vector<BasicBlock *> NodeVector;
     typedef std::list<BasicBlockEdge *> EdgeList;
 
+    // Marker for names that have no block yet.
+    static constexpr int kNoIndex = -1;
+
+    // Names from 0 up to twice the number of blocks, plus this many, are
+    // looked up in a table; negative ones and those further out, which
+    // would leave the table mostly empty, in a hash map.
+    static constexpr int kMinDenseNames = 1024;
+
     MaoCFG() : start_node_(NULL) {
     }
 
     ~MaoCFG() {
-        for (NodeMap::iterator it = basic_block_map_.begin();
-             it != basic_block_map_.end(); ++it)
-            delete (*it).second;
+        // Blocks live in arena_, only their edge vectors need freeing.
+        for (NodeVector::iterator it = basic_blocks_.begin();
+             it != basic_blocks_.end(); ++it)
+            (*it)->~BasicBlock();
 
         for (EdgeList::iterator edge_it = edge_list_.begin();
              edge_it != edge_list_.end(); ++edge_it)
@@ -88,16 +124,12 @@ public:
     }
 
     BasicBlock *CreateNode(int name) {
-        BasicBlock *node;
-
-        NodeMap::iterator it = basic_block_map_.find(name);
-
-        if (it == basic_block_map_.end()) {
-            node = new BasicBlock(name);
-            basic_block_map_[name] = node;
-        } else {
-            node = (*it).second;
+        int &index = IndexOf(name);
+        if (index == kNoIndex) {
+            index = basic_blocks_.size();
+            basic_blocks_.push_back(arena_.New<BasicBlock>(name, index));
         }
+        BasicBlock *node = basic_blocks_[index];
 
         if (GetNumNodes() == 1)
             start_node_ = node;
@@ -105,15 +137,26 @@ public:
         return node;
     }
 
+    // Add an edge between the blocks named 'from' and 'to', creating the
+    // blocks as needed. The edge is owned by the CFG's arena.
+    BasicBlockEdge *CreateEdge(int from, int to) {
+        BasicBlock *src = CreateNode(from);
+        BasicBlock *dst = CreateNode(to);
+        return new (arena_.Allocate(sizeof(BasicBlockEdge),
+                                    alignof(BasicBlockEdge)))
+            BasicBlockEdge(src, dst);
+    }
+
+    // Take ownership of a heap-allocated edge.
     void AddEdge(BasicBlockEdge *edge) {
         edge_list_.push_back(edge);
     }
 
-    int GetNumNodes() {
-        return basic_block_map_.size();
+    int GetNumNodes() const {
+        return basic_blocks_.size();
     }
 
-    BasicBlock *GetStartBasicBlock() {
+    BasicBlock *GetStartBasicBlock() const {
         return start_node_;
     }
 
@@ -125,14 +168,105 @@ public:
         return edge->GetSrc();
     }
 
-    NodeMap *GetBasicBlocks() {
-        return &basic_block_map_;
+    // All blocks, in index order.
+    NodeVector *GetBasicBlocks() {
+        return &basic_blocks_;
+    }
+
+    BasicBlock *GetBasicBlock(int index) const {
+        return basic_blocks_[index];
     }
 
+    // Freeze the current graph into a CSR snapshot. Node ids are the
+    // BasicBlock indices.
+    inline void BuildSnapshot(CSRGraph *graph);
+
 private:
-    NodeMap basic_block_map_;
+    // The index of the block named 'name', or kNoIndex, as a slot to set.
+    int &IndexOf(int name) {
+        if (name >= 0 && name < static_cast<int>(name_to_index_.size()))
+            return name_to_index_[name];
+
+        int dense = 2 * GetNumNodes() + kMinDenseNames;
+        if (name < 0 || name >= dense)
+            return sparse_name_to_index_.emplace(name, kNoIndex).first->second;
+
+        // grow the table geometrically, and move the names that now fall
+        // within it over from the hash map
+        size_t size = std::min<size_t>(std::max<size_t>(name + 1, 2 * name_to_index_.size()),
+                                       dense);
+        name_to_index_.resize(size, kNoIndex);
+        for (auto it = sparse_name_to_index_.begin(); it != sparse_name_to_index_.end();) {
+            if (it->first >= 0 && it->first < static_cast<int>(size)) {
+                name_to_index_[it->first] = it->second;
+                it = sparse_name_to_index_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return name_to_index_[name];
+    }
+
+    Arena arena_;                     // blocks and CreateEdge() edges
+    NodeVector basic_blocks_;
+    std::vector<int> name_to_index_;  // block name -> index, or kNoIndex
+    std::unordered_map<int, int> sparse_name_to_index_;  // names outside it
     BasicBlock *start_node_;
-    EdgeList edge_list_;
+    EdgeList edge_list_;              // heap-allocated edges
+};
+
+// The ids of the blocks an edge vector points to, for GraphTraits<MaoCFG>.
+class BlockIdIterator {
+public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef uint32_t value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const uint32_t *pointer;
+    typedef uint32_t reference;
+
+    BlockIdIterator() {}
+    explicit BlockIdIterator(BasicBlock::EdgeVector::const_iterator it) : it_(it) {}
+
+    uint32_t operator*() const { return (*it_)->index(); }
+    BlockIdIterator &operator++() { ++it_; return *this; }
+    BlockIdIterator operator++(int) { return BlockIdIterator(it_++); }
+    bool operator==(const BlockIdIterator &other) const { return it_ == other.it_; }
+    bool operator!=(const BlockIdIterator &other) const { return it_ != other.it_; }
+
+private:
+    BasicBlock::EdgeVector::const_iterator it_;
+};
+
+// The loop finder templates run on a MaoCFG in place, without taking a
+// CSR snapshot first; node ids are the block indices.
+template <>
+struct GraphTraits<MaoCFG> {
+    typedef uint32_t NodeId;
+    typedef BlockIdIterator EdgeIterator;
+    typedef IteratorRange<BlockIdIterator> EdgeRange;
+
+    static constexpr NodeId kNoNode = UINT32_MAX;
+
+    static NodeId NumNodes(const MaoCFG &g) { return g.GetNumNodes(); }
+
+    static NodeId StartNode(const MaoCFG &g) {
+        return g.GetStartBasicBlock() ? g.GetStartBasicBlock()->index() : kNoNode;
+    }
+
+    static EdgeRange Successors(const MaoCFG &g, NodeId v) {
+        return Edges(g.GetBasicBlock(v)->out_edges());
+    }
+
+    static EdgeRange Predecessors(const MaoCFG &g, NodeId v) {
+        return Edges(g.GetBasicBlock(v)->in_edges());
+    }
+
+    static BasicBlock *Block(const MaoCFG &g, NodeId v) { return g.GetBasicBlock(v); }
+
+private:
+    static EdgeRange Edges(const BasicBlock::EdgeVector *edges) {
+        return EdgeRange(BlockIdIterator(edges->begin()), BlockIdIterator(edges->end()));
+    }
 };
 
 //
@@ -149,22 +283,26 @@ private:
 // it can be an irreducible loop, have control flow, be
 // a candidate for transformations, and what not.
 //
+// A SimpleLoop is a view into the LoopStructureGraph that created it:
+// its basic blocks and children are kept in the graph's flat arrays,
+// and GetBasicBlocks()/GetChildren() return ranges into them. Those
+// ranges are invalidated by the next change to the graph's structure
+// (AddNode, set_parent, AddLoop).
 //
 class SimpleLoop {
 public:
-    typedef std::set<BasicBlock *> BasicBlockSet;
-    typedef std::set<SimpleLoop *> LoopSet;
+    typedef ArrayRange<BasicBlock *const> BasicBlockRange;
+    typedef ArrayRange<SimpleLoop *const> LoopRange;
 
-    SimpleLoop() : parent_(NULL), is_root_(false), nesting_level_(0),
-                   depth_level_(0) {
+    explicit SimpleLoop(LoopStructureGraph *lsg)
+        : lsg_(lsg), parent_(NULL), header_(NULL), is_root_(false),
+          counter_(0), nesting_level_(0), depth_level_(0) {
     }
 
-    void AddNode(BasicBlock *basic_block) {
-        basic_blocks_.insert(basic_block);
-    }
+    inline void AddNode(BasicBlock *basic_block);
 
     void AddChildLoop(SimpleLoop *loop) {
-        children_.insert(loop);
+        loop->set_parent(this);
     }
 
     void Dump() {
@@ -173,9 +311,10 @@ public:
                 counter_, nesting_level_, depth_level_);
     }
 
-    LoopSet *GetChildren() {
-        return &children_;
-    }
+    // Blocks in insertion order, children in the order they were added
+    // to the graph.
+    inline BasicBlockRange GetBasicBlocks();
+    inline LoopRange GetChildren();
 
     // Getters/Setters
     SimpleLoop *parent() { return parent_; }
@@ -184,10 +323,7 @@ public:
     int counter() const { return counter_; }
     bool is_root() const { return is_root_; }
 
-    void set_parent(SimpleLoop *parent) {
-        parent_ = parent;
-        parent->AddChildLoop(this);
-    }
+    inline void set_parent(SimpleLoop *parent);
 
     void set_is_root() { is_root_ = true; }
     void set_counter(int value) { counter_ = value; }
@@ -201,10 +337,9 @@ public:
     void set_header(BasicBlock *bb) { header_ = bb; }
 
 private:
-    BasicBlockSet basic_blocks_;
-    std::set<SimpleLoop *> children_;
+    LoopStructureGraph *lsg_;
     SimpleLoop *parent_;
-    BasicBlock *header_ = nullptr;
+    BasicBlock *header_;
 
     bool is_root_ : 1;
     int counter_;
@@ -227,53 +362,88 @@ private:
 //   loop-3    1                1
 //     loop-2  0                2
 //
+// The forest is stored compactly: loops live in a vector (SimpleLoop
+// objects themselves in an arena), and block membership and child lists
+// are flat arrays with per-loop offsets, indexed by loop counter.
+//
+// Memberships and parent links are appended as the loop finders report
+// them and folded into the flat arrays on the first read after a change,
+// with a stable counting sort, so iteration order is deterministic.
+//
+// A graph can be cleared and refilled: the SimpleLoop objects and the
+// capacity of every array are kept, so once a graph has held the largest
+// forest it will see, analyzing another function into it allocates
+// nothing.
+//
 class LoopStructureGraph {
 public:
-    typedef std::list<SimpleLoop *> LoopList;
-
-    LoopStructureGraph() : root_(new SimpleLoop()),
-                           loop_counter_(0) {
-        root_->set_nesting_level(0); // make it the root node
-        root_->set_counter(loop_counter_++);
-        AddLoop(root_);
-    }
+    typedef std::vector<SimpleLoop *> LoopVector;
 
-    ~LoopStructureGraph() {
-        KillAll();
+    LoopStructureGraph() : arena_(1024), loop_counter_(0), dirty_(false) {
+        CreateRoot();
     }
 
     SimpleLoop *CreateNewLoop() {
-        SimpleLoop *loop = new SimpleLoop();
+        SimpleLoop *loop;
+        if (loop_counter_ < static_cast<int>(made_.size())) {
+            // recycle the loop a previous forest had with this counter
+            loop = made_[loop_counter_];
+            *loop = SimpleLoop(this);
+        } else {
+            loop = arena_.New<SimpleLoop>(this);
+            made_.push_back(loop);
+        }
         loop->set_counter(loop_counter_++);
+        dirty_ = true;
         return loop;
     }
 
+    // Destroy all loops, including the root. Afterwards the graph is
+    // empty and GetNumLoops() returns 0.
     void KillAll() {
-        for (LoopList::iterator it = loops_.begin(); it != loops_.end(); ++it)
-            delete (*it);
+        loops_.clear();
+        pending_blocks_.clear();
+        block_offsets_.clear();
+        blocks_.clear();
+        child_offsets_.clear();
+        children_.clear();
+        loop_counter_ = 0;
+        dirty_ = false;
+        root_ = NULL;
+    }
+
+    // Drop all loops and start over with a fresh root, as if the graph
+    // had just been constructed, keeping the storage for reuse. Loops
+    // handed out before are invalid afterwards.
+    void Clear() {
+        KillAll();
+        CreateRoot();
     }
 
     void AddLoop(SimpleLoop *loop) {
         loops_.push_back(loop);
+        dirty_ = true;
     }
 
     void Dump() {
-        DumpRec(root_, 0);
+        if (root_)
+            DumpRec(root_, 0);
     }
 
     void DumpRec(SimpleLoop *loop, int indent) {
         // Simplified for readability purposes.
         loop->Dump();
 
-        for (SimpleLoop::LoopSet::iterator liter = loop->GetChildren()->begin();
-             liter != loop->GetChildren()->end(); ++liter)
-            DumpRec(*liter, indent + 1);
+        for (SimpleLoop *child : loop->GetChildren())
+            DumpRec(child, indent + 1);
     }
 
     void CalculateNestingLevel() {
+        if (!root_)
+            return;
+
         // link up all 1st level loops to artificial root node.
-        fprintf(stderr, "Linking up loops to root node\n");
-        for (LoopList::iterator liter = loops_.begin();
+        for (LoopVector::iterator liter = loops_.begin();
              liter != loops_.end(); ++liter) {
             SimpleLoop *loop = *liter;
             if (loop->is_root())
@@ -281,61 +451,178 @@ public:
             if (!loop->parent())
                 loop->set_parent(root_);
         }
-        fprintf(stderr, "Loop list size: %zu\n", loops_.size());
-
-        // int index = 0;
-        // for (LoopList::iterator liter = loops_.begin();
-        //      liter != loops_.end(); ++liter, ++index) {
 
-        //     // fprintf(stderr, "Processing loop %d...\n", index);
-
-        //     if (!*liter) {
-        //         // fprintf(stderr, "Null loop pointer at index %d!\n", index);
-        //         continue;
-        //     }
-
-        //     SimpleLoop *loop = *liter;
-
-        //     // fprintf(stderr, "Checking if loop is root...\n");
-        //     if (loop->is_root())
-        //         continue;
-
-        //     // fprintf(stderr, "Checking if loop has parent...\n");
-        //     if (!loop->parent()) {
-        //         if (!root_) {
-        //             // fprintf(stderr, "root_ is null!\n");
-        //             abort(); // or return, to avoid deref
-        //         }
-        //         loop->set_parent(root_);
-        //     }
-        // }
-
-        // fprintf(stderr, "Calculating nesting levels\n");
         // recursively traverse the tree and assign levels.
         CalculateNestingLevelRec(root_, 0);
     }
 
     void CalculateNestingLevelRec(SimpleLoop *loop, int depth) {
         loop->set_depth_level(depth);
-        for (SimpleLoop::LoopSet::iterator liter = loop->GetChildren()->begin();
-             liter != loop->GetChildren()->end(); ++liter) {
-            CalculateNestingLevelRec(*liter, depth + 1);
+        for (SimpleLoop *child : loop->GetChildren()) {
+            CalculateNestingLevelRec(child, depth + 1);
 
             loop->set_nesting_level(std::max(loop->nesting_level(),
-                                             1 + (*liter)->nesting_level()));
+                                             1 + child->nesting_level()));
         }
     }
 
     int GetNumLoops() const { return loops_.size(); }
 
+    // All loops, root first, in the order they were added.
+    SimpleLoop::LoopRange GetLoops() {
+        return SimpleLoop::LoopRange(loops_.data(),
+                                     loops_.data() + loops_.size());
+    }
+
     SimpleLoop *root() const { return root_; }
 
 private:
+    friend class SimpleLoop;
+
+    void CreateRoot() {
+        root_ = CreateNewLoop();
+        root_->set_nesting_level(0); // make it the root node
+        AddLoop(root_);
+    }
+
+    struct Membership {
+        int loop;          // loop counter
+        BasicBlock *block;
+    };
+
+    void AddMembership(SimpleLoop *loop, BasicBlock *block) {
+        Membership m = {loop->counter(), block};
+        pending_blocks_.push_back(m);
+        dirty_ = true;
+    }
+
+    SimpleLoop::BasicBlockRange BlocksOf(SimpleLoop *loop) {
+        Compact();
+        BasicBlock *const *base = blocks_.data();
+        return SimpleLoop::BasicBlockRange(
+            base + block_offsets_[loop->counter()],
+            base + block_offsets_[loop->counter() + 1]);
+    }
+
+    SimpleLoop::LoopRange ChildrenOf(SimpleLoop *loop) {
+        Compact();
+        SimpleLoop *const *base = children_.data();
+        return SimpleLoop::LoopRange(
+            base + child_offsets_[loop->counter()],
+            base + child_offsets_[loop->counter() + 1]);
+    }
+
+    // Fold pending memberships into the flat block array and rebuild the
+    // child arrays from the parent links, both bucketed by loop counter.
+    void Compact() {
+        if (!dirty_)
+            return;
+        dirty_ = false;
+
+        int num_loops = loop_counter_;
+
+        // the new arrays are built in the scratch ones and swapped in, so
+        // both keep their capacity from one forest to the next
+        std::vector<int> &offsets = scratch_offsets_;
+        offsets.assign(num_loops + 1, 0);
+        for (int l = 0; l + 1 < static_cast<int>(block_offsets_.size()); ++l)
+            offsets[l + 1] += block_offsets_[l + 1] - block_offsets_[l];
+        for (size_t i = 0; i < pending_blocks_.size(); ++i)
+            offsets[pending_blocks_[i].loop + 1]++;
+        for (int l = 0; l < num_loops; ++l)
+            offsets[l + 1] += offsets[l];
+
+        std::vector<BasicBlock *> &blocks = scratch_blocks_;
+        blocks.resize(offsets[num_loops]);
+        std::vector<int> &fill = fill_;
+        fill.assign(offsets.begin(), offsets.end() - 1);
+        int max_index = -1;
+        for (int l = 0; l + 1 < static_cast<int>(block_offsets_.size()); ++l)
+            for (int i = block_offsets_[l]; i < block_offsets_[l + 1]; ++i)
+                blocks[fill[l]++] = blocks_[i];
+        for (size_t i = 0; i < pending_blocks_.size(); ++i) {
+            BasicBlock *bb = pending_blocks_[i].block;
+            blocks[fill[pending_blocks_[i].loop]++] = bb;
+            max_index = std::max(max_index, bb->index());
+        }
+        pending_blocks_.clear();
+
+        // Membership has set semantics; drop repeated blocks per loop,
+        // keeping the first occurrence.
+        if (max_index >= 0) {
+            std::vector<int> &seen = seen_;
+            seen.assign(max_index + 1, -1);
+            int out = 0;
+            for (int l = 0; l < num_loops; ++l) {
+                int begin = offsets[l];
+                offsets[l] = out;
+                for (int i = begin; i < offsets[l + 1]; ++i) {
+                    int index = blocks[i]->index();
+                    if (index <= max_index) {
+                        if (seen[index] == l)
+                            continue;
+                        seen[index] = l;
+                    }
+                    blocks[out++] = blocks[i];
+                }
+            }
+            offsets[num_loops] = out;
+            blocks.resize(out);
+        }
+
+        block_offsets_.swap(offsets);
+        blocks_.swap(blocks);
+
+        child_offsets_.assign(num_loops + 1, 0);
+        for (size_t i = 0; i < loops_.size(); ++i)
+            if (loops_[i]->parent())
+                child_offsets_[loops_[i]->parent()->counter() + 1]++;
+        for (int l = 0; l < num_loops; ++l)
+            child_offsets_[l + 1] += child_offsets_[l];
+
+        children_.resize(child_offsets_[num_loops]);
+        fill.assign(child_offsets_.begin(), child_offsets_.end() - 1);
+        for (size_t i = 0; i < loops_.size(); ++i)
+            if (loops_[i]->parent())
+                children_[fill[loops_[i]->parent()->counter()]++] = loops_[i];
+    }
+
+    Arena arena_;                            // SimpleLoop storage
+    std::vector<SimpleLoop *> made_;         // all of it, by loop counter
     SimpleLoop *root_;
-    LoopList loops_;
+    LoopVector loops_;
     int loop_counter_;
+
+    bool dirty_;                             // flat arrays are stale
+    std::vector<Membership> pending_blocks_; // not yet in blocks_
+    std::vector<int> block_offsets_;         // loop counter -> blocks_
+    std::vector<BasicBlock *> blocks_;
+    std::vector<int> child_offsets_;         // loop counter -> children_
+    std::vector<SimpleLoop *> children_;
+
+    std::vector<int> scratch_offsets_;       // Compact() temporaries
+    std::vector<BasicBlock *> scratch_blocks_;
+    std::vector<int> fill_;
+    std::vector<int> seen_;
 };
 
+inline void SimpleLoop::AddNode(BasicBlock *basic_block) {
+    lsg_->AddMembership(this, basic_block);
+}
+
+inline void SimpleLoop::set_parent(SimpleLoop *parent) {
+    parent_ = parent;
+    lsg_->dirty_ = true;
+}
+
+inline SimpleLoop::BasicBlockRange SimpleLoop::GetBasicBlocks() {
+    return lsg_->BlocksOf(this);
+}
+
+inline SimpleLoop::LoopRange SimpleLoop::GetChildren() {
+    return lsg_->ChildrenOf(this);
+}
+
 inline BasicBlockEdge::BasicBlockEdge(MaoCFG *cfg,
                                       int from_name,
                                       int to_name) {
@@ -348,13 +635,79 @@ inline BasicBlockEdge::BasicBlockEdge(MaoCFG *cfg,
     cfg->AddEdge(this);
 }
 
+inline BasicBlockEdge::BasicBlockEdge(BasicBlock *from, BasicBlock *to)
+    : from_(from), to_(to) {
+    from_->AddOutEdge(to_);
+    to_->AddInEdge(from_);
+}
+
+inline void MaoCFG::BuildSnapshot(CSRGraph *graph) {
+    typedef CSRGraph::NodeId NodeId;
+
+    NodeId size = GetNumNodes();
+
+    graph->blocks_.assign(basic_blocks_.begin(), basic_blocks_.end());
+    graph->start_node_ = start_node_ ? start_node_->index() : CSRGraph::kNoNode;
+
+    graph->out_offsets_.assign(size + 1, 0);
+    graph->in_offsets_.assign(size + 1, 0);
+    for (NodeId v = 0; v < size; ++v) {
+        BasicBlock *bb = graph->blocks_[v];
+        graph->out_offsets_[v + 1] = graph->out_offsets_[v] + bb->GetNumSucc();
+        graph->in_offsets_[v + 1] = graph->in_offsets_[v] + bb->GetNumPred();
+    }
+
+    graph->out_targets_.resize(graph->out_offsets_[size]);
+    graph->in_targets_.resize(graph->in_offsets_[size]);
+    for (NodeId v = 0; v < size; ++v) {
+        BasicBlock *bb = graph->blocks_[v];
+        NodeId *out = graph->out_targets_.data() + graph->out_offsets_[v];
+        for (BasicBlock::EdgeVector::iterator it = bb->out_edges()->begin();
+             it != bb->out_edges()->end(); ++it)
+            *out++ = (*it)->index();
+        NodeId *in = graph->in_targets_.data() + graph->in_offsets_[v];
+        for (BasicBlock::EdgeVector::iterator it = bb->in_edges()->begin();
+             it != bb->in_edges()->end(); ++it)
+            *in++ = (*it)->index();
+    }
+}
+
 // External entry point.
 int FindHavlakLoops(MaoCFG *CFG, LoopStructureGraph *LSG);
+int FindHavlakLoops(const CSRGraph &graph, LoopStructureGraph *LSG);
+
+// Same, with the scratch memory taken from 'workspace' (see
+// loop-workspace.h); NULL uses the heap.
+int FindHavlakLoops(const CSRGraph &graph, LoopStructureGraph *LSG,
+                    LoopAnalysisWorkspace *workspace);
+
+// Entry point that picks the finder by size: graphs of up to
+// kMaxSmallLoopNodes blocks go to the bit-parallel one (see
+// small-loops.h), larger ones to Havlak's algorithm. Both build the
+// same forest. The named entry points above and below always run their
+// own algorithm.
+int FindLoopsAuto(MaoCFG *CFG, LoopStructureGraph *LSG);
+int FindLoopsAuto(const CSRGraph &graph, LoopStructureGraph *LSG,
+                  LoopAnalysisWorkspace *workspace);
+
+// Whether FindLoopsAuto() hands 'graph' to the bit-parallel finder.
+bool FitsSmallLoops(const CSRGraph &graph);
+
+// FindHavlakLoopsIn(), FindTarjanLoopsIn() and FindFWBWLoopsIn() in
+// mao-loops-inl.h, tarjan-loops-inl.h and fwbw-loops-inl.h run the same
+// algorithms on any graph with GraphTraits (see graph-traits.h).
+
+// Havlak with the original recursive DFS numbering, whose native stack
+// depth grows with the longest DFS path. Benchmark baseline only.
+int FindHavlakLoopsRecursiveDFS(const CSRGraph &graph,
+                                LoopStructureGraph *LSG);
 
 // tarjan external entry point
 int FindTarjanLoops(MaoCFG *CFG, LoopStructureGraph *LSG);
+int FindTarjanLoops(const CSRGraph &graph, LoopStructureGraph *LSG);
 
 // fwbw external entry point for FWBW Trim algorithm
 int FindFWBWLoops(MaoCFG *CFG, LoopStructureGraph *LSG);
+int FindFWBWLoops(const CSRGraph &graph, LoopStructureGraph *LSG);
 
 #endif // MAO_LOOPS_H_
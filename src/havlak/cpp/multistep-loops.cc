@@ -0,0 +1,471 @@
+#include <algorithm>
+#include <atomic>
+#include <memory_resource>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "atomic-bitmap.h"
+#include "loop-workspace.h"
+#include "mao-loops.h"
+#include "multistep-loops.h"
+#include "scc-records.h"
+#include "scratch-array.h"
+#include "thread-pool.h"
+
+// Multistep SCC algorithm for finding loops (Slota, Rajamanickam and
+// Madduri, 2014)
+//
+// Control flow graphs of large functions tend to have one huge SCC, the
+// dispatch loop, next to thousands of small ones. FWBW finds the small
+// ones one pivot at a time; Multistep runs three steps instead:
+//
+//   1. trim the nodes that cannot be on a cycle,
+//   2. peel off the largest SCC with a single forward-backward search
+//      from the node with the most edges,
+//   3. find all remaining SCCs at once by coloring: every node takes the
+//      largest id that reaches it, and each node that keeps its own id
+//      collects its SCC among the nodes of its color backwards. Repeat
+//      on what is left until nothing is.
+//
+// Partitions are colored ranges of order_ as in FWBW. The loops nested
+// in an SCC are found by running the same steps on its body without the
+// header (see scc-records.h); on deep loop nests that costs up to n
+// times the nesting depth.
+class MultistepLoopFinder {
+public:
+    typedef CSRGraph::NodeId NodeId;
+    typedef uint32_t Color;
+
+    // color of trimmed nodes and single node non-loops
+    static const Color kNoPartition = 0;
+
+    // per-node arrays are taken from 'memory', the partitions' scratch
+    // from the thread-safe 'shared'
+    MultistepLoopFinder(const CSRGraph &graph, LoopStructureGraph *lsg,
+                        const MultistepOptions &options,
+                        std::pmr::memory_resource *memory,
+                        std::pmr::memory_resource *shared)
+        : graph_(graph), lsg_(lsg), shared_(shared), color_(memory), label_(memory),
+          order_(memory), inDegree_(memory), outDegree_(memory),
+          nextColor_(kNoPartition + 1), queued_(memory), sccs_(graph, memory),
+          tasks_(options.pool ? options.pool : ThreadPool::Default()) {
+    }
+
+    void FindLoops() {
+        if (graph_.start_node() == CSRGraph::kNoNode)
+            return;
+
+        // one partition holding all nodes
+        NodeId size = graph_.GetNumNodes();
+        Color all = NewColor();
+        color_.Reset(size);
+        label_.Reset(size);
+        inDegree_.resize(size);
+        outDegree_.resize(size);
+        queued_.Reset(size);
+        order_.resize(size);
+        sccs_.Reset();
+        for (NodeId id = 0; id < size; ++id) {
+            color_[id].store(all, std::memory_order_relaxed);
+            order_[id] = id;
+        }
+
+        FindLoopsIn(0, size, all, CSRGraph::kNoNode);
+
+        // barrier, helping with the loop bodies still queued
+        tasks_.Wait();
+
+        sccs_.BuildForest(order_, lsg_);
+        lsg_->CalculateNestingLevel();
+    }
+
+private:
+    // partitions at least kParallelSize large are worked on in parallel,
+    // in chunks of kGrain nodes, if the pool has workers
+    static const NodeId kParallelSize = 16 * 1024;
+    static const NodeId kGrain = 4 * 1024;
+    static const NodeId kFrontierGrain = 512;
+    static const NodeId kRootGrain = 64;
+
+    // loop bodies up to this size are searched inline, not as tasks
+    static const NodeId kInlineBody = 10;
+
+    // find the SCCs of the partition order_[begin, end) of color 'color',
+    // in the body of the loop with header 'parent' (or kNoNode)
+    void FindLoopsIn(NodeId begin, NodeId end, Color color, NodeId parent) {
+        // step 1
+        end = Trim(begin, end, color);
+        if (begin == end)
+            return;
+
+        // step 2
+        NodeId grain = Grain(begin, end);
+        NodeId pivot = PickPivot(begin, end);
+        Color reached = NewColor();
+        Color giant = NewColor();
+        Sweep(pivot, true, color, reached, grain);
+        if (Sweep(pivot, false, reached, giant, grain) == 1 && !HasSelfLoop(pivot))
+            SetColor(pivot, kNoPartition);
+        ParallelFor(tasks_.pool(), end - begin, grain, [&](size_t, size_t lo, size_t hi) {
+            for (size_t i = begin + lo; i < begin + hi; ++i) {
+                if (GetColor(order_[i]) == reached)
+                    SetColor(order_[i], color);
+            }
+        });
+
+        // step 3
+        ColorRest(begin, end, color);
+
+        // every SCC has a color of its own now: the giant one goes to
+        // the front, the small ones behind it are grouped by color
+        NodeId *first = &order_[0] + begin;
+        NodeId *last = &order_[0] + end;
+        NodeId *giantEnd = std::partition(first, last, HasColor(this, giant));
+        NodeId *smallEnd = std::partition(giantEnd, last, [this](NodeId id) {
+            return GetColor(id) != kNoPartition;
+        });
+        std::sort(giantEnd, smallEnd, [this](NodeId a, NodeId b) {
+            return GetColor(a) < GetColor(b);
+        });
+
+        if (giantEnd != first)
+            RegisterLoop(first, giantEnd, parent);
+        for (NodeId *scc = giantEnd; scc != smallEnd;) {
+            Color c = GetColor(*scc);
+            NodeId *sccEnd = scc + 1;
+            while (sccEnd != smallEnd && GetColor(*sccEnd) == c)
+                ++sccEnd;
+            RegisterLoop(scc, sccEnd, parent);
+            scc = sccEnd;
+        }
+    }
+
+    // Record the SCC order_[first, last), nested in the loop with header
+    // 'parent', and search its body for nested loops. The header moves
+    // to the front of the range and the body behind it becomes a
+    // partition of its own.
+    void RegisterLoop(NodeId *first, NodeId *last, NodeId parent) {
+        NodeId header = sccs_.FindHeader(first, last);
+        std::iter_swap(first, std::find(first, last, header));
+        sccs_.Add(first - &order_[0], last - &order_[0], header, parent);
+
+        NodeId begin = first + 1 - &order_[0];
+        NodeId end = last - &order_[0];
+        if (begin == end)
+            return;
+
+        Color body = NewColor();
+        for (NodeId i = begin; i < end; ++i)
+            SetColor(order_[i], body);
+
+        // small bodies inline, which bounds the recursion by their size
+        if (end - begin <= kInlineBody) {
+            FindLoopsIn(begin, end, body, header);
+        } else {
+            tasks_.Run([this, begin, end, body, header] {
+                FindLoopsIn(begin, end, body, header);
+            });
+        }
+    }
+
+    Color NewColor() {
+        return nextColor_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Color GetColor(NodeId id) const {
+        return color_[id].load(std::memory_order_relaxed);
+    }
+
+    void SetColor(NodeId id, Color color) {
+        color_[id].store(color, std::memory_order_relaxed);
+    }
+
+    struct HasColor {
+        HasColor(const MultistepLoopFinder *finder, Color color)
+            : finder(finder), color(color) {}
+        bool operator()(NodeId id) const { return finder->GetColor(id) == color; }
+        const MultistepLoopFinder *finder;
+        Color color;
+    };
+
+    bool HasSelfLoop(NodeId id) const {
+        for (NodeId succ : graph_.out_edges(id))
+            if (succ == id)
+                return true;
+        return false;
+    }
+
+    bool IsLarge(NodeId begin, NodeId end) const {
+        return end - begin >= kParallelSize && tasks_.pool()->num_workers() > 0;
+    }
+
+    // ParallelFor() grain for a scan over a partition; 0 runs it inline
+    NodeId Grain(NodeId begin, NodeId end) const {
+        return IsLarge(begin, end) ? kGrain : 0;
+    }
+
+    // Drop the nodes of the partition that cannot be on a cycle within
+    // it: count every node's partition edges in parallel, then peel
+    // those whose count drops to zero. Returns the new end of the range,
+    // which holds the nodes left.
+    NodeId Trim(NodeId begin, NodeId end, Color color) {
+        NodeId grain = Grain(begin, end);
+        NodeId *first = &order_[0] + begin;
+
+        std::pmr::vector<std::pmr::vector<NodeId>> zero(NumChunks(end - begin, grain), shared_);
+        ParallelFor(tasks_.pool(), end - begin, grain, [&](size_t chunk, size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; ++i) {
+                NodeId id = first[i];
+                int in = 0;
+                int out = 0;
+                for (NodeId pred : graph_.in_edges(id))
+                    in += GetColor(pred) == color;
+                for (NodeId succ : graph_.out_edges(id))
+                    out += GetColor(succ) == color;
+                inDegree_[id] = in;
+                outDegree_[id] = out;
+                if (!in || !out)
+                    zero[chunk].push_back(id);
+            }
+        });
+
+        std::pmr::vector<NodeId> worklist(shared_);
+        for (std::pmr::vector<NodeId> &nodes : zero)
+            worklist.insert(worklist.end(), nodes.begin(), nodes.end());
+        while (!worklist.empty()) {
+            NodeId id = worklist.back();
+            worklist.pop_back();
+            if (GetColor(id) != color)
+                continue;
+
+            SetColor(id, kNoPartition);
+            for (NodeId succ : graph_.out_edges(id)) {
+                if (GetColor(succ) == color && --inDegree_[succ] == 0)
+                    worklist.push_back(succ);
+            }
+            for (NodeId pred : graph_.in_edges(id)) {
+                if (GetColor(pred) == color && --outDegree_[pred] == 0)
+                    worklist.push_back(pred);
+            }
+        }
+
+        return std::partition(first, &order_[0] + end, HasColor(this, color)) - &order_[0];
+    }
+
+    // the node with the largest product of partition in- and out-degree
+    // (lowest id on ties), the one most likely in the largest SCC
+    NodeId PickPivot(NodeId begin, NodeId end) {
+        NodeId grain = Grain(begin, end);
+        std::pmr::vector<NodeId> best(NumChunks(end - begin, grain), CSRGraph::kNoNode, shared_);
+        ParallelFor(tasks_.pool(), end - begin, grain, [&](size_t chunk, size_t lo, size_t hi) {
+            for (size_t i = begin + lo; i < begin + hi; ++i) {
+                if (best[chunk] == CSRGraph::kNoNode || Better(order_[i], best[chunk]))
+                    best[chunk] = order_[i];
+            }
+        });
+
+        NodeId pivot = best[0];
+        for (NodeId candidate : best) {
+            if (Better(candidate, pivot))
+                pivot = candidate;
+        }
+        return pivot;
+    }
+
+    bool Better(NodeId a, NodeId b) const {
+        int64_t degreeA = int64_t(inDegree_[a]) * outDegree_[a];
+        int64_t degreeB = int64_t(inDegree_[b]) * outDegree_[b];
+        return degreeA != degreeB ? degreeA > degreeB : a < b;
+    }
+
+    // Recolor from 'from' to 'to' every node reachable from 'start' (which
+    // gets 'to' in any case), along out edges if 'forward' and in edges
+    // otherwise, passing only through nodes of color 'from'. If grain > 0
+    // breadth first, each level spread over the pool, else depth first.
+    // Returns the number of nodes recolored, 'start' included.
+    NodeId Sweep(NodeId start, bool forward, Color from, Color to, NodeId grain) {
+        SetColor(start, to);
+        std::pmr::vector<NodeId> frontier(1, start, shared_);
+        NodeId count = 0;
+
+        if (!grain) {
+            while (!frontier.empty()) {
+                NodeId id = frontier.back();
+                frontier.pop_back();
+                count++;
+                CSRGraph::NodeRange edges = forward ? graph_.out_edges(id) : graph_.in_edges(id);
+                for (NodeId neighborId : edges) {
+                    if (GetColor(neighborId) == from) {
+                        SetColor(neighborId, to);
+                        frontier.push_back(neighborId);
+                    }
+                }
+            }
+            return count;
+        }
+
+        while (!frontier.empty()) {
+            count += frontier.size();
+            std::pmr::vector<std::pmr::vector<NodeId>> next(
+                NumChunks(frontier.size(), kFrontierGrain), shared_);
+            ParallelFor(tasks_.pool(), frontier.size(), kFrontierGrain,
+                        [&](size_t chunk, size_t lo, size_t hi) {
+                for (size_t i = lo; i < hi; ++i) {
+                    NodeId id = frontier[i];
+                    CSRGraph::NodeRange edges = forward ? graph_.out_edges(id) : graph_.in_edges(id);
+                    for (NodeId neighborId : edges) {
+                        Color expected = from;
+                        if (color_[neighborId].compare_exchange_strong(expected, to,
+                                                                       std::memory_order_relaxed))
+                            next[chunk].push_back(neighborId);
+                    }
+                }
+            });
+
+            frontier.clear();
+            for (std::pmr::vector<NodeId> &nodes : next)
+                frontier.insert(frontier.end(), nodes.begin(), nodes.end());
+        }
+        return count;
+    }
+
+    // Step 3 on the nodes of the range still of color 'color'. Each round
+    // finds at least the SCC of the largest id left.
+    void ColorRest(NodeId begin, NodeId end, Color color) {
+        for (;;) {
+            NodeId *first = &order_[0] + begin;
+            end = std::partition(first, &order_[0] + end, HasColor(this, color)) - &order_[0];
+            if (begin == end)
+                return;
+
+            NodeId grain = Grain(begin, end);
+            ParallelFor(tasks_.pool(), end - begin, grain, [&](size_t, size_t lo, size_t hi) {
+                for (size_t i = lo; i < hi; ++i)
+                    label_[first[i]].store(first[i], std::memory_order_relaxed);
+            });
+
+            // propagate the largest label forward to a fixed point, from
+            // a worklist if grain is 0, else in parallel rounds
+            std::pmr::vector<NodeId> frontier(first, &order_[0] + end, shared_);
+            while (!grain && !frontier.empty()) {
+                NodeId id = frontier.back();
+                frontier.pop_back();
+                queued_.Clear(id);
+                PushLabel(id, color, &frontier);
+            }
+            while (!frontier.empty()) {
+                std::pmr::vector<std::pmr::vector<NodeId>> next(
+                NumChunks(frontier.size(), kFrontierGrain), shared_);
+                ParallelFor(tasks_.pool(), frontier.size(), kFrontierGrain,
+                            [&](size_t chunk, size_t lo, size_t hi) {
+                    for (size_t i = lo; i < hi; ++i)
+                        PushLabel(frontier[i], color, &next[chunk]);
+                });
+
+                frontier.clear();
+                for (std::pmr::vector<NodeId> &nodes : next)
+                    frontier.insert(frontier.end(), nodes.begin(), nodes.end());
+                for (NodeId id : frontier)
+                    queued_.Clear(id);
+            }
+
+            // nodes that kept their own label are roots
+            std::pmr::vector<std::pmr::vector<NodeId>> roots(NumChunks(end - begin, grain),
+                                                             shared_);
+            ParallelFor(tasks_.pool(), end - begin, grain, [&](size_t chunk, size_t lo, size_t hi) {
+                for (size_t i = lo; i < hi; ++i) {
+                    if (label_[first[i]].load(std::memory_order_relaxed) == first[i])
+                        roots[chunk].push_back(first[i]);
+                }
+            });
+            std::pmr::vector<NodeId> allRoots(shared_);
+            for (std::pmr::vector<NodeId> &nodes : roots)
+                allRoots.insert(allRoots.end(), nodes.begin(), nodes.end());
+
+            ParallelFor(tasks_.pool(), allRoots.size(), grain ? kRootGrain : 0,
+                        [&](size_t, size_t lo, size_t hi) {
+                for (size_t i = lo; i < hi; ++i)
+                    CollectScc(allRoots[i], color);
+            });
+        }
+    }
+
+    // raise the labels of the partition successors of 'id' to its own,
+    // queueing those that were lower and are not queued yet
+    void PushLabel(NodeId id, Color color, std::pmr::vector<NodeId> *queue) {
+        NodeId label = label_[id].load(std::memory_order_relaxed);
+        for (NodeId succ : graph_.out_edges(id)) {
+            if (GetColor(succ) == color && RaiseLabel(succ, label) && queued_.TestAndSet(succ))
+                queue->push_back(succ);
+        }
+    }
+
+    // raise the label of 'id' to 'label', return whether it was lower
+    bool RaiseLabel(NodeId id, NodeId label) {
+        NodeId current = label_[id].load(std::memory_order_relaxed);
+        while (current < label) {
+            if (label_[id].compare_exchange_weak(current, label, std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+    // Give the SCC of 'root', the nodes of its label that reach it, a
+    // color of its own; a single node without a self-loop is no loop.
+    // Roots have distinct labels, so they may run at the same time.
+    void CollectScc(NodeId root, Color color) {
+        Color scc = NewColor();
+        std::pmr::vector<NodeId> stack(1, root, shared_);
+        SetColor(root, scc);
+        bool single = true;
+
+        while (!stack.empty()) {
+            NodeId id = stack.back();
+            stack.pop_back();
+            for (NodeId pred : graph_.in_edges(id)) {
+                if (GetColor(pred) == color &&
+                    label_[pred].load(std::memory_order_relaxed) == root) {
+                    SetColor(pred, scc);
+                    stack.push_back(pred);
+                    single = false;
+                }
+            }
+        }
+
+        if (single && !HasSelfLoop(root))
+            SetColor(root, kNoPartition);
+    }
+
+    const CSRGraph &graph_;                         // snapshot of the control flow graph
+    LoopStructureGraph *lsg_;                       // loop forest
+    std::pmr::memory_resource *shared_;             // scratch of the partitions
+    ScratchArray<std::atomic<Color> > color_;       // partition of each node
+    ScratchArray<std::atomic<NodeId> > label_;      // coloring label of each node
+    std::pmr::vector<NodeId> order_;                // nodes, grouped by partition
+    std::pmr::vector<int> inDegree_;                // partition edges into each node,
+    std::pmr::vector<int> outDegree_;               // and out of it, after trimming
+    std::atomic<Color> nextColor_;                  // next unused color
+    AtomicBitmap queued_;                           // in the next coloring frontier
+    SccRecords<CSRGraph> sccs_;                     // loops found so far
+    TaskGroup tasks_;                               // loop bodies queued on the pool
+};
+
+// external entry point for the Multistep algorithm
+int FindMultistepLoops(MaoCFG *CFG, LoopStructureGraph *LSG) {
+    CSRGraph graph;
+    CFG->BuildSnapshot(&graph);
+    return FindMultistepLoops(graph, LSG);
+}
+
+int FindMultistepLoops(const CSRGraph &graph, LoopStructureGraph *LSG) {
+    return FindMultistepLoops(graph, LSG, MultistepOptions());
+}
+
+int FindMultistepLoops(const CSRGraph &graph, LoopStructureGraph *LSG,
+                       const MultistepOptions &options) {
+    MultistepLoopFinder finder(graph, LSG, options, BeginScratch(options.workspace),
+                               SharedScratch(options.workspace));
+    finder.FindLoops();
+    return LSG->GetNumLoops();
+}
@@ -0,0 +1,31 @@
+#ifndef MULTISTEP_LOOPS_H_
+#define MULTISTEP_LOOPS_H_
+
+#include "mao-loops.h"
+#include "thread-pool.h"
+
+// forward declaration of the MultistepLoopFinder class
+class MultistepLoopFinder;
+
+// tuning knobs for the Multistep engine
+struct MultistepOptions {
+    // pool running the searches; the calling thread helps out while it
+    // waits. NULL means ThreadPool::Default().
+    ThreadPool *pool = nullptr;
+
+    // scratch memory for the calling thread's arrays (see
+    // loop-workspace.h); NULL uses the heap
+    LoopAnalysisWorkspace *workspace = nullptr;
+};
+
+// entry point for the Multistep algorithm
+int FindMultistepLoops(MaoCFG *CFG, LoopStructureGraph *LSG);
+
+// same, running directly on a frozen CSR snapshot
+int FindMultistepLoops(const CSRGraph &graph, LoopStructureGraph *LSG);
+
+// same, with explicit options
+int FindMultistepLoops(const CSRGraph &graph, LoopStructureGraph *LSG,
+                       const MultistepOptions &options);
+
+#endif // MULTISTEP_LOOPS_H_
@@ -0,0 +1,144 @@
+#ifndef PEARCE_SCC_H_
+#define PEARCE_SCC_H_
+
+#include <stdint.h>
+#include <memory_resource>
+#include <vector>
+
+#include "graph-traits.h"
+
+// PearceSCC
+//
+// Iterative strongly connected components search over the dense node ids
+// of a graph (see graph-traits.h), after Pearce, D.J., 2016, A space-efficient algorithm
+// for finding strongly connected components. Tarjan's discovery time,
+// lowlink and on-stack flag fold into a single rindex word per node plus
+// a root bit: a node still being searched holds the lowest discovery
+// index it can reach, and a finished one the number of its component,
+// counted down from the top of the range so that it compares above every
+// live index. The recursion becomes an explicit stack of edge cursors,
+// so the search depth is bounded by memory, not by the thread's stack.
+//
+// Search() can be restricted to a region of the graph, and run again on
+// regions whose nodes were handed to Unvisit() first; Tarjan's loop
+// finder does so for the bodies of nested loops.
+//
+template <typename Graph>
+class PearceSCC {
+public:
+    typedef GraphTraits<Graph> Traits;
+    typedef typename Traits::NodeId NodeId;
+
+    explicit PearceSCC(const Graph &graph,
+                       std::pmr::memory_resource *memory =
+                           std::pmr::get_default_resource())
+        : graph_(graph), rindex_(memory), root_(memory), frames_(memory),
+          stack_(memory), members_(memory) {
+    }
+
+    // Mark all nodes unvisited.
+    void Reset() {
+        rindex_.assign(Traits::NumNodes(graph_), 0);
+        root_.assign(Traits::NumNodes(graph_), false);
+    }
+
+    // Mark one node unvisited again.
+    void Unvisit(NodeId node) {
+        rindex_[node] = 0;
+    }
+
+    // Whether a search has entered the node since it was last unvisited.
+    bool Visited(NodeId node) const {
+        return rindex_[node] != 0;
+    }
+
+    // Find the SCCs reachable from 'start' through nodes for which
+    // in_region(node) holds ('start' itself is not asked). Calls
+    // visit(root, first, last) for each, in reverse topological order,
+    // with its nodes in [first, last); the root, the node of the SCC the
+    // search entered first, comes last.
+    template <typename InRegion, typename Visit>
+    void Search(NodeId start, const InRegion &in_region, const Visit &visit) {
+        index_ = 1;
+        component_ = Traits::kNoNode - 1;
+        BeginVisit(start);
+
+        while (!frames_.empty()) {
+            Frame &top = frames_.back();
+            NodeId v = top.node;
+
+            if (top.next == top.end) {
+                frames_.pop_back();
+                FinishVisit(v, visit);
+                continue;
+            }
+
+            // look at the edge again once w is finished
+            NodeId w = *top.next;
+            if (!in_region(w)) {
+                ++top.next;
+                continue;
+            }
+            if (rindex_[w] == 0) {
+                BeginVisit(w);
+                continue;
+            }
+
+            ++top.next;
+            if (rindex_[w] < rindex_[v]) {
+                rindex_[v] = rindex_[w];
+                root_[v] = false;
+            }
+        }
+    }
+
+private:
+    // a node being searched and its next out edge
+    struct Frame {
+        NodeId node;
+        typename Traits::EdgeIterator next;
+        typename Traits::EdgeIterator end;
+    };
+
+    void BeginVisit(NodeId v) {
+        rindex_[v] = index_++;
+        root_[v] = true;
+        typename Traits::EdgeRange edges = Traits::Successors(graph_, v);
+        frames_.push_back(Frame{v, edges.begin(), edges.end()});
+    }
+
+    // v is done: the root of an SCC pops the nodes above it off the
+    // stack, anything else goes on it
+    template <typename Visit>
+    void FinishVisit(NodeId v, const Visit &visit) {
+        if (!root_[v]) {
+            stack_.push_back(v);
+            return;
+        }
+
+        members_.clear();
+        index_--;
+        while (!stack_.empty() && rindex_[v] <= rindex_[stack_.back()]) {
+            NodeId w = stack_.back();
+            stack_.pop_back();
+            rindex_[w] = component_;
+            index_--;
+            members_.push_back(w);
+        }
+        rindex_[v] = component_--;
+        members_.push_back(v);
+
+        visit(v, members_.data(), members_.data() + members_.size());
+    }
+
+    const Graph &graph_;
+    std::pmr::vector<NodeId> rindex_;  // index while searched, then component
+    std::pmr::vector<bool> root_;      // no lower index reached yet
+    std::pmr::vector<Frame> frames_;   // the search path
+    std::pmr::vector<NodeId> stack_;   // finished nodes of open components
+    std::pmr::vector<NodeId> members_; // component handed to visit
+    NodeId index_;                // next discovery index
+    NodeId component_;            // next component number
+};
+
+#endif // PEARCE_SCC_H_
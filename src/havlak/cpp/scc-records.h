@@ -0,0 +1,205 @@
+#ifndef SCC_RECORDS_H_
+#define SCC_RECORDS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <memory_resource>
+#include <vector>
+
+#include "graph-traits.h"
+#include "mao-loops.h"
+
+// SccRecords
+//
+// Loops found by the partitioning SCC engines (FWBW, multistep), which
+// keep every partition as a contiguous range of one node order and find
+// the loops nested in an SCC as the SCCs of its body without the header.
+// Each loop is recorded as its range of that order, header first, and
+// the header of the enclosing loop. Ranges of nested loops then fall
+// within the enclosing one's, which is all BuildForest() needs to hand
+// every block to its innermost loop once the search is done, in one
+// pass over the order.
+//
+// The search itself is what costs on deep nesting: each level searches
+// the body of the level above once more, so a node is searched once per
+// loop it is nested in, n times the nesting depth in all. On a chain of
+// loops each nested in the next that is quadratic, where Havlak's
+// algorithm stays near linear.
+//
+// Add() may be called from any number of threads: slots are handed out
+// by an atomic counter, and as a node heads at most one loop there are
+// never more records than nodes.
+//
+// 'Graph' is any graph with GraphTraits (see graph-traits.h).
+//
+template <typename Graph>
+class SccRecords {
+public:
+    typedef GraphTraits<Graph> Traits;
+    typedef typename Traits::NodeId NodeId;
+
+    // Records and node numbers are taken from 'memory'.
+    explicit SccRecords(const Graph &graph,
+                        std::pmr::memory_resource *memory =
+                            std::pmr::get_default_resource());
+
+    // Drop all records and number the nodes for FindHeader().
+    void Reset();
+
+    // The node of [first, last) entered first by the depth-first search
+    // Havlak's algorithm numbers the nodes with, so that all engines
+    // agree on headers; nodes the search does not reach rank after all
+    // others, by id.
+    NodeId FindHeader(const NodeId *first, const NodeId *last) const;
+
+    // Record the loop order[begin, end), whose header is order[begin],
+    // nested in the loop with header 'parent' (or kNoNode).
+    void Add(NodeId begin, NodeId end, NodeId header, NodeId parent);
+
+    // Add the recorded loops to 'lsg', in header order so that the forest
+    // does not depend on which thread found which loop first. As in
+    // Havlak's algorithm, a loop's blocks are the nodes of its body
+    // outside nested loops; headers are only known through header().
+    void BuildForest(const std::pmr::vector<NodeId> &order, LoopStructureGraph *lsg);
+
+private:
+    struct Record {
+        NodeId begin;
+        NodeId end;
+        NodeId header;
+        NodeId parent; // header of the enclosing loop, or kNoNode
+    };
+
+    void NumberNodes();
+
+    const Graph &graph_;
+    std::pmr::memory_resource *memory_;
+    std::pmr::vector<NodeId> preorder_; // DFS number of each node
+    std::pmr::vector<Record> records_;
+    std::atomic<NodeId> numRecords_;
+};
+
+template <typename Graph>
+SccRecords<Graph>::SccRecords(const Graph &graph, std::pmr::memory_resource *memory)
+    : graph_(graph), memory_(memory), preorder_(memory), records_(memory),
+      numRecords_(0) {
+}
+
+template <typename Graph>
+void SccRecords<Graph>::Reset() {
+    records_.resize(Traits::NumNodes(graph_));
+    numRecords_.store(0, std::memory_order_relaxed);
+    NumberNodes();
+}
+
+// preorder of an iterative DFS from the start node, like Havlak's, then
+// the dead nodes in id order
+template <typename Graph>
+void SccRecords<Graph>::NumberNodes() {
+    struct Frame {
+        NodeId node;
+        typename Traits::EdgeIterator next;
+        typename Traits::EdgeIterator end;
+    };
+    NodeId size = Traits::NumNodes(graph_);
+    preorder_.assign(size, Traits::kNoNode);
+    std::pmr::vector<Frame> stack(memory_);
+
+    NodeId start = Traits::StartNode(graph_);
+    NodeId number = 0;
+    preorder_[start] = number++;
+    typename Traits::EdgeRange edges = Traits::Successors(graph_, start);
+    stack.push_back(Frame{start, edges.begin(), edges.end()});
+
+    while (!stack.empty()) {
+        Frame &top = stack.back();
+        if (top.next == top.end) {
+            stack.pop_back();
+            continue;
+        }
+
+        NodeId target = *top.next++;
+        if (preorder_[target] != Traits::kNoNode)
+            continue;
+
+        preorder_[target] = number++;
+        edges = Traits::Successors(graph_, target);
+        stack.push_back(Frame{target, edges.begin(), edges.end()});
+    }
+
+    for (NodeId id = 0; id < size; ++id) {
+        if (preorder_[id] == Traits::kNoNode)
+            preorder_[id] = number++;
+    }
+}
+
+template <typename Graph>
+typename SccRecords<Graph>::NodeId
+SccRecords<Graph>::FindHeader(const NodeId *first, const NodeId *last) const {
+    NodeId header = *first;
+    for (const NodeId *node = first + 1; node != last; ++node) {
+        if (preorder_[*node] < preorder_[header])
+            header = *node;
+    }
+    return header;
+}
+
+template <typename Graph>
+void SccRecords<Graph>::Add(NodeId begin, NodeId end, NodeId header, NodeId parent) {
+    NodeId slot = numRecords_.fetch_add(1, std::memory_order_relaxed);
+    records_[slot].begin = begin;
+    records_[slot].end = end;
+    records_[slot].header = header;
+    records_[slot].parent = parent;
+}
+
+template <typename Graph>
+void SccRecords<Graph>::BuildForest(const std::pmr::vector<NodeId> &order,
+                                    LoopStructureGraph *lsg) {
+    Record *first = records_.data();
+    Record *last = first + numRecords_.load(std::memory_order_relaxed);
+    std::sort(first, last, [](const Record &a, const Record &b) {
+        return a.header < b.header;
+    });
+
+    NodeId size = Traits::NumNodes(graph_);
+    std::pmr::vector<SimpleLoop *> loopOf(size, nullptr, memory_);
+    for (Record *scc = first; scc != last; ++scc) {
+        SimpleLoop *loop = lsg->CreateNewLoop();
+        loop->set_header(Traits::Block(graph_, scc->header));
+        loopOf[scc->header] = loop;
+        lsg->AddLoop(loop);
+    }
+
+    // the ranges, by where they begin; no two begin at the same place,
+    // as a nested range begins behind its enclosing one's header
+    std::pmr::vector<Record *> beginning(order.size(), nullptr, memory_);
+    for (Record *scc = first; scc != last; ++scc) {
+        if (scc->parent != Traits::kNoNode)
+            loopOf[scc->header]->set_parent(loopOf[scc->parent]);
+        beginning[scc->begin] = scc;
+    }
+
+    // The ranges nest like the loops, so a node's block belongs to the
+    // innermost range holding it behind the header. One pass over the
+    // order keeps the ranges open at each place on a stack, innermost on
+    // top.
+    std::pmr::vector<SimpleLoop *> owner(size, nullptr, memory_);
+    std::pmr::vector<Record *> open(memory_);
+    for (NodeId i = 0; i < order.size(); ++i) {
+        while (!open.empty() && open.back()->end <= i)
+            open.pop_back();
+        if (!open.empty())
+            owner[order[i]] = loopOf[open.back()->header];
+        if (beginning[i])
+            open.push_back(beginning[i]);
+    }
+
+    // add the blocks in id order, but for headers
+    for (NodeId id = 0; id < size; ++id) {
+        if (owner[id] && !loopOf[id])
+            owner[id]->AddNode(Traits::Block(graph_, id));
+    }
+}
+
+#endif // SCC_RECORDS_H_
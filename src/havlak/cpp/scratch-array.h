@@ -0,0 +1,56 @@
+#ifndef SCRATCH_ARRAY_H_
+#define SCRATCH_ARRAY_H_
+
+#include <stddef.h>
+#include <memory_resource>
+#include <new>
+
+// ScratchArray
+//
+// Fixed-size array taken from a std::pmr memory resource, for element
+// types std::pmr::vector cannot resize because they cannot be moved,
+// like the atomics the parallel engines keep per node. Elements are
+// value-initialized and must be trivially destructible.
+//
+template <typename T>
+class ScratchArray {
+public:
+    explicit ScratchArray(std::pmr::memory_resource *memory =
+                              std::pmr::get_default_resource())
+        : memory_(memory), data_(nullptr), size_(0) {
+    }
+
+    ~ScratchArray() {
+        Release();
+    }
+
+    // Make room for 'size' elements; the old ones are gone.
+    void Reset(size_t size) {
+        Release();
+        data_ = static_cast<T *>(memory_->allocate(size * sizeof(T), alignof(T)));
+        size_ = size;
+        for (size_t i = 0; i < size; ++i)
+            new (&data_[i]) T();
+    }
+
+    size_t size() const { return size_; }
+
+    T &operator[](size_t i) const { return data_[i]; }
+
+private:
+    ScratchArray(const ScratchArray &);
+    ScratchArray &operator=(const ScratchArray &);
+
+    void Release() {
+        if (data_)
+            memory_->deallocate(data_, size_ * sizeof(T), alignof(T));
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    std::pmr::memory_resource *memory_;
+    T *data_;
+    size_t size_;
+};
+
+#endif // SCRATCH_ARRAY_H_
@@ -0,0 +1,325 @@
+#ifndef SMALL_LOOPS_H_
+#define SMALL_LOOPS_H_
+
+#include <stdint.h>
+
+#include "graph-traits.h"
+#include "mao-loops.h"
+
+// SmallBitset
+//
+// Fixed set of kBits node ids in machine words, kept by value: the small
+// loop finder's adjacency rows, regions and reachable sets. Like a plain
+// array, a new set is uninitialized until Clear() or SetFirst().
+//
+template <int kBits>
+class SmallBitset {
+public:
+    static const int kWords = kBits / 64;
+
+    void Clear() {
+        for (int i = 0; i < kWords; ++i)
+            words_[i] = 0;
+    }
+
+    // bits [0, size) set, the others clear
+    void SetFirst(int size) {
+        for (int i = 0; i < kWords; ++i) {
+            int bits = size - i * 64;
+            words_[i] = bits >= 64 ? ~uint64_t(0) : bits > 0 ? (uint64_t(1) << bits) - 1 : 0;
+        }
+    }
+
+    void Set(int i) { words_[i >> 6] |= uint64_t(1) << (i & 63); }
+    void Reset(int i) { words_[i >> 6] &= ~(uint64_t(1) << (i & 63)); }
+    bool Test(int i) const { return (words_[i >> 6] >> (i & 63)) & 1; }
+
+    bool Empty() const {
+        uint64_t any = 0;
+        for (int i = 0; i < kWords; ++i)
+            any |= words_[i];
+        return !any;
+    }
+
+    int Count() const {
+        int count = 0;
+        for (int i = 0; i < kWords; ++i)
+            count += __builtin_popcountll(words_[i]);
+        return count;
+    }
+
+    // lowest set bit; the set must not be empty
+    int First() const {
+        int i = 0;
+        while (!words_[i])
+            ++i;
+        return i * 64 + __builtin_ctzll(words_[i]);
+    }
+
+    SmallBitset &operator|=(const SmallBitset &other) {
+        for (int i = 0; i < kWords; ++i)
+            words_[i] |= other.words_[i];
+        return *this;
+    }
+
+    SmallBitset &operator&=(const SmallBitset &other) {
+        for (int i = 0; i < kWords; ++i)
+            words_[i] &= other.words_[i];
+        return *this;
+    }
+
+    // remove the bits of 'other'
+    SmallBitset &Subtract(const SmallBitset &other) {
+        for (int i = 0; i < kWords; ++i)
+            words_[i] &= ~other.words_[i];
+        return *this;
+    }
+
+    // call f(i) for every set bit i, in increasing order
+    template <typename F>
+    void ForEach(const F &f) const {
+        for (int i = 0; i < kWords; ++i) {
+            for (uint64_t word = words_[i]; word; word &= word - 1)
+                f(i * 64 + __builtin_ctzll(word));
+        }
+    }
+
+private:
+    uint64_t words_[kWords];
+};
+
+// SmallLoopFinder
+//
+// Loop finder for graphs of at most kBits nodes, which are most of the
+// functions of a program. The adjacency is read once into a successor
+// and a predecessor bitset per node; everything after that is bitwise.
+// The SCCs of a region are found after Kosaraju: a DFS over the region,
+// which picks each node's next unvisited successor as the lowest bit of
+// its row masked by the unvisited set, gives the finish order; taken in
+// reverse, each node not yet placed is in a source SCC of the nodes
+// left, and its backward closure among them, a BFS that ORs the rows of
+// a whole frontier per step, is exactly that SCC. As in the other
+// engines, an SCC's header is the node Havlak's DFS enters first, and
+// the loops nested in it are the SCCs of its body without the header.
+//
+// The forest is the one FindHavlakLoops builds: a loop's blocks are the
+// nodes of its body outside nested loops, headers are only known through
+// header(). Only nodes reachable from the start node are considered,
+// unless 'all_nodes' is set, in which case loops in unreachable code are
+// found too, as FindFWBWLoops does.
+//
+// The finder lives on the stack, no memory is allocated but the loops.
+// 'Graph' is any graph with GraphTraits (see graph-traits.h).
+//
+template <typename Graph, int kBits>
+class SmallLoopFinder {
+public:
+    typedef GraphTraits<Graph> Traits;
+    typedef typename Traits::NodeId NodeId;
+    typedef SmallBitset<kBits> Bitset;
+
+    SmallLoopFinder(const Graph &graph, LoopStructureGraph *lsg, bool all_nodes)
+        : graph_(graph), lsg_(lsg), all_nodes_(all_nodes), num_pending_(0) {
+    }
+
+    void FindLoops() {
+        NodeId start = Traits::StartNode(graph_);
+        if (start == Traits::kNoNode)
+            return;
+
+        size_ = Traits::NumNodes(graph_);
+        for (int v = 0; v < size_; ++v) {
+            succ_[v].Clear();
+            pred_[v].Clear();
+        }
+        for (int v = 0; v < size_; ++v) {
+            for (NodeId w : Traits::Successors(graph_, v)) {
+                succ_[v].Set(w);
+                pred_[w].Set(v);
+            }
+        }
+
+        Bitset nodes = NumberNodes(start);
+        if (all_nodes_)
+            nodes.SetFirst(size_);
+
+        AddSccs(nodes, nullptr);
+        while (num_pending_) {
+            Pending &pending = pending_[--num_pending_];
+            AddSccs(pending.body, pending.loop);
+        }
+    }
+
+private:
+    // a loop whose body, without the header, is still to be searched
+    // for nested loops
+    struct Pending {
+        Bitset body;
+        SimpleLoop *loop;
+    };
+
+    // Number the nodes in the preorder of Havlak's DFS, which follows
+    // the out edges in order, and then the unreached ones by id, as
+    // SccRecords does. Returns the reached nodes.
+    Bitset NumberNodes(NodeId start) {
+        struct Frame {
+            NodeId node;
+            typename Traits::EdgeIterator next;
+            typename Traits::EdgeIterator end;
+        };
+        Frame stack[kBits];
+        int depth = 0;
+
+        Bitset reached;
+        reached.Clear();
+        int number = 0;
+        reached.Set(start);
+        preorder_[start] = number++;
+        typename Traits::EdgeRange edges = Traits::Successors(graph_, start);
+        stack[depth++] = Frame{start, edges.begin(), edges.end()};
+
+        while (depth) {
+            Frame &top = stack[depth - 1];
+            if (top.next == top.end) {
+                --depth;
+                continue;
+            }
+
+            NodeId target = *top.next;
+            ++top.next;
+            if (reached.Test(target))
+                continue;
+
+            reached.Set(target);
+            preorder_[target] = number++;
+            edges = Traits::Successors(graph_, target);
+            stack[depth++] = Frame{target, edges.begin(), edges.end()};
+        }
+
+        for (int v = 0; v < size_; ++v) {
+            if (!reached.Test(v))
+                preorder_[v] = number++;
+        }
+        return reached;
+    }
+
+    // the nodes of 'region' reachable from 'pivot' within it, along the
+    // rows of 'adjacency'
+    Bitset Closure(int pivot, const Bitset &region, const Bitset *adjacency) const {
+        Bitset seen;
+        seen.Clear();
+        seen.Set(pivot);
+        Bitset frontier = seen;
+        while (!frontier.Empty()) {
+            Bitset next;
+            next.Clear();
+            frontier.ForEach([&](int v) { next |= adjacency[v]; });
+            next &= region;
+            next.Subtract(seen);
+            seen |= next;
+            frontier = next;
+        }
+        return seen;
+    }
+
+    // the nodes of 'region' in the order a DFS over it finishes them,
+    // into finished_; returns their number
+    int FinishOrder(const Bitset &region) {
+        Bitset unvisited = region;
+        int count = 0;
+        while (!unvisited.Empty()) {
+            int depth = 0;
+            int root = unvisited.First();
+            unvisited.Reset(root);
+            stack_[depth++] = root;
+            while (depth) {
+                int v = stack_[depth - 1];
+                Bitset next = succ_[v];
+                next &= unvisited;
+                if (next.Empty()) {
+                    finished_[count++] = v;
+                    --depth;
+                    continue;
+                }
+                int w = next.First();
+                unvisited.Reset(w);
+                stack_[depth++] = w;
+            }
+        }
+        return count;
+    }
+
+    // Split 'region' into its SCCs. Nodes on no cycle are blocks of
+    // 'parent', if any; each cycle becomes a loop nested in it, whose
+    // body waits in pending_.
+    void AddSccs(Bitset region, SimpleLoop *parent) {
+        for (int i = FinishOrder(region) - 1; i >= 0; --i) {
+            int pivot = finished_[i];
+            if (!region.Test(pivot))
+                continue;
+            Bitset scc = Closure(pivot, region, pred_);
+            region.Subtract(scc);
+
+            if (scc.Count() == 1 && !succ_[pivot].Test(pivot)) {
+                if (parent)
+                    parent->AddNode(Traits::Block(graph_, pivot));
+                continue;
+            }
+
+            int header = pivot;
+            scc.ForEach([&](int v) {
+                if (preorder_[v] < preorder_[header])
+                    header = v;
+            });
+
+            SimpleLoop *loop = lsg_->CreateNewLoop();
+            loop->set_header(Traits::Block(graph_, header));
+            if (parent)
+                loop->set_parent(parent);
+            lsg_->AddLoop(loop);
+
+            scc.Reset(header);
+            pending_[num_pending_].body = scc;
+            pending_[num_pending_].loop = loop;
+            ++num_pending_;
+        }
+    }
+
+    const Graph &graph_;
+    LoopStructureGraph *lsg_;
+    bool all_nodes_;             // include nodes the start does not reach
+    int size_;                   // number of nodes
+    Bitset succ_[kBits];         // successors of each node,
+    Bitset pred_[kBits];         // and predecessors
+    int preorder_[kBits];        // DFS number of each node
+    int stack_[kBits];           // FinishOrder()'s DFS path,
+    int finished_[kBits];        // and the nodes it finished
+    Pending pending_[kBits];     // loops to decompose, at most one per node
+    int num_pending_;
+};
+
+// largest graph FindSmallLoops() takes
+static const int kMaxSmallLoopNodes = 256;
+
+// Find the loops of 'graph' with the SmallLoopFinder of the narrowest
+// width that holds it: 64, 128 or 256 nodes. Returns false, leaving
+// 'lsg' alone, if the graph has more than kMaxSmallLoopNodes nodes.
+template <typename Graph>
+bool FindSmallLoops(const Graph &graph, LoopStructureGraph *lsg, bool all_nodes) {
+    size_t size = GraphTraits<Graph>::NumNodes(graph);
+    if (size <= 64) {
+        SmallLoopFinder<Graph, 64> finder(graph, lsg, all_nodes);
+        finder.FindLoops();
+    } else if (size <= 128) {
+        SmallLoopFinder<Graph, 128> finder(graph, lsg, all_nodes);
+        finder.FindLoops();
+    } else if (size <= kMaxSmallLoopNodes) {
+        SmallLoopFinder<Graph, 256> finder(graph, lsg, all_nodes);
+        finder.FindLoops();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+#endif // SMALL_LOOPS_H_
@@ -0,0 +1,203 @@
+#ifndef TARJAN_LOOPS_INL_H_
+#define TARJAN_LOOPS_INL_H_
+
+#include <memory_resource>
+#include <vector>
+
+#include "graph-traits.h"
+#include "loop-workspace.h"
+#include "mao-loops.h"
+#include "pearce-scc.h"
+#include "tarjan-loops.h"
+
+// What TarjanLoopFinder tells an engine built on it, as it searches;
+// this one lets it all pass. Engines pass their own, with the same
+// members.
+template <typename NodeId>
+struct TarjanHooks {
+    // Whether the nodes the start node does not reach are searched as
+    // well, for their SCCs only: they are in no loop.
+    bool SearchUnreached() const { return false; }
+
+    // An SCC [first, last) of the outermost search. They come up sinks
+    // first, so the SCCs an SCC has edges into came up before it.
+    void Component(const NodeId * /*first*/, const NodeId * /*last*/) {}
+
+    // 'header' heads a loop, nested in the one 'parent' heads (kNoNode
+    // at the top).
+    void Loop(NodeId /*header*/, NodeId /*parent*/) {}
+
+    // 'node' is a block of the loop 'header' heads (kNoNode: of none).
+    void Block(NodeId /*node*/, NodeId /*header*/) {}
+};
+
+// Tarjan's algorithm for finding Strongly Connected Components (loops),
+// in Pearce's iterative form (see pearce-scc.h)
+//
+// The SCCs of the graph are the outermost loops. The loops nested in an
+// SCC are the SCCs of its body with the header taken out, that is with
+// the header's incoming back edges removed, and so on down. Each level
+// reruns the search on the body of one loop only; the root of an SCC,
+// its first node entered, is its header. A node is thus searched once
+// per loop around it: the time grows with n times the nesting depth,
+// quadratic on loops nested as deep as the graph is large.
+//
+// As in Havlak's algorithm, a loop's blocks are the nodes of its body
+// outside nested loops; headers are only known through header().
+//
+// 'Graph' is any graph with GraphTraits (see graph-traits.h). 'Hooks'
+// hears of the SCCs and loops as they are found, for engines that keep
+// more than the loop forest; TarjanHooks does nothing.
+template <typename Graph, typename Hooks = TarjanHooks<typename GraphTraits<Graph>::NodeId> >
+class TarjanLoopFinder {
+public:
+    typedef GraphTraits<Graph> Traits;
+    typedef typename Traits::NodeId NodeId;
+
+    TarjanLoopFinder(const Graph &graph, LoopStructureGraph *lsg,
+                     std::pmr::memory_resource *memory, const Hooks &hooks = Hooks())
+        : graph_(graph), lsg_(lsg), hooks_(hooks), scc_(graph, memory), live_(true),
+          region_(0), region_of_(memory), region_header_(Traits::kNoNode),
+          region_loop_(nullptr), members_(memory), pending_(memory),
+          body_(memory) {}
+
+    void FindLoops() {
+        if (Traits::StartNode(graph_) == Traits::kNoNode)
+            return;
+
+        // all unvisited, all in the outermost region
+        scc_.Reset();
+        region_of_.assign(Traits::NumNodes(graph_), region_);
+
+        // search from the start node
+        Search(Traits::StartNode(graph_));
+
+        // the nodes it does not reach, for the hooks only
+        if (hooks_.SearchUnreached()) {
+            live_ = false;
+            for (NodeId id = 0; id < Traits::NumNodes(graph_); ++id) {
+                if (!scc_.Visited(id))
+                    Search(id);
+            }
+            live_ = true;
+        }
+
+        // decompose the loops found, which may queue more
+        while (!pending_.empty()) {
+            Pending loop = pending_.back();
+            pending_.pop_back();
+            body_.assign(members_.begin() + loop.begin, members_.end());
+            members_.resize(loop.begin);
+            Decompose(loop.loop, loop.header);
+        }
+
+        // all loops are found, calculate nesting levels
+        lsg_->CalculateNestingLevel();
+    }
+
+private:
+    // a loop whose body (in members_ from 'begin' on) is still to be
+    // searched for nested loops
+    struct Pending {
+        size_t begin;
+        NodeId header;
+        SimpleLoop *loop;
+    };
+
+    // find the loops nested in 'loop', whose nodes are in body_
+    void Decompose(SimpleLoop *loop, NodeId header) {
+        region_++;
+        for (NodeId v : body_) {
+            region_of_[v] = region_;
+            scc_.Unvisit(v);
+        }
+        region_header_ = header;
+        region_loop_ = loop;
+
+        // every node of the body is reachable from the header
+        Search(header);
+    }
+
+    // edges leaving the region, or entering its header, are ignored
+    bool InRegion(NodeId node) const {
+        return region_of_[node] == region_ && node != region_header_;
+    }
+
+    void Search(NodeId start) {
+        scc_.Search(start,
+                    [this](NodeId node) { return InRegion(node); },
+                    [this](NodeId root, const NodeId *first, const NodeId *last) {
+                        AddComponent(root, first, last);
+                    });
+    }
+
+    // an SCC [first, last) of the region, entered first at 'root'
+    void AddComponent(NodeId root, const NodeId *first, const NodeId *last) {
+        if (region_ == 0)
+            hooks_.Component(first, last);
+
+        // the region's header is the root of the whole search, the
+        // enclosing loop has it already
+        if (!live_ || root == region_header_)
+            return;
+
+        // process SCCs with more than one node or self-loops
+        bool is_loop = last - first > 1;
+        if (!is_loop) {
+            // self-loop
+            for (NodeId succ : Traits::Successors(graph_, root)) {
+                if (succ == root) {
+                    is_loop = true;
+                    break;
+                }
+            }
+        }
+
+        if (!is_loop) {
+            if (region_loop_)
+                region_loop_->AddNode(Traits::Block(graph_, root));
+            hooks_.Block(root, region_header_);
+            return;
+        }
+
+        // new loop, nested in the region's; the root is its header
+        SimpleLoop *loop = lsg_->CreateNewLoop();
+        loop->set_header(Traits::Block(graph_, root));
+        if (region_loop_)
+            loop->set_parent(region_loop_);
+        lsg_->AddLoop(loop);
+        hooks_.Loop(root, region_header_);
+
+        // its body, minus the header (last), waits for decomposition
+        Pending pending = {members_.size(), root, loop};
+        pending_.push_back(pending);
+        members_.insert(members_.end(), first, last - 1);
+    }
+
+    const Graph &graph_;                 // the control flow graph
+    LoopStructureGraph *lsg_;            // loop forest
+    Hooks hooks_;                        // engine hearing of the search
+    PearceSCC<Graph> scc_;               // SCC search state
+    bool live_;                          // searching nodes the start reaches
+
+    int region_;                         // body searched by the current search,
+    std::pmr::vector<int> region_of_;    // and the last one each node was in
+    NodeId region_header_;               // header of that body's loop,
+    SimpleLoop *region_loop_;            // and the loop, NULL at the top
+    std::pmr::vector<NodeId> members_;   // bodies of the pending loops,
+    std::pmr::vector<Pending> pending_;  // which are still to decompose
+    std::pmr::vector<NodeId> body_;      // body being decomposed
+};
+
+// Tarjan's algorithm on any graph with GraphTraits, read in place; the
+// scratch memory is taken from 'workspace' (see loop-workspace.h), or
+// the heap if it is NULL
+template <typename Graph>
+int FindTarjanLoopsIn(const Graph &graph, LoopStructureGraph *LSG,
+                      LoopAnalysisWorkspace *workspace = nullptr) {
+    TarjanLoopFinder<Graph> finder(graph, LSG, BeginScratch(workspace));
+    finder.FindLoops();
+    return LSG->GetNumLoops();
+}
+
+#endif // TARJAN_LOOPS_INL_H_
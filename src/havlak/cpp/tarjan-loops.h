@@ -3,10 +3,21 @@
 
 #include "mao-loops.h"
 
-// forward declaration of the TarjanLoopFinder class
+// forward declaration of the TarjanLoopFinder class template, which
+// tarjan-loops-inl.h defines for any graph with GraphTraits, and the
+// hooks an engine built on it may pass
+template <typename Graph, typename Hooks>
 class TarjanLoopFinder;
 
 // entry point for Tarjan's algorithm
 int FindTarjanLoops(MaoCFG *CFG, LoopStructureGraph *LSG);
 
+// same, running directly on a frozen CSR snapshot
+int FindTarjanLoops(const CSRGraph &graph, LoopStructureGraph *LSG);
+
+// same, with the scratch memory taken from 'workspace' (see
+// loop-workspace.h); NULL uses the heap
+int FindTarjanLoops(const CSRGraph &graph, LoopStructureGraph *LSG,
+                    LoopAnalysisWorkspace *workspace);
+
 #endif // TARJAN_LOOPS_H_
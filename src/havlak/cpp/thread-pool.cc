@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+#include <utility>
+
+#include "thread-pool.h"
+
+namespace {
+
+// the pool the current thread works for and its queue there, if any
+thread_local const ThreadPool *tls_pool = nullptr;
+thread_local int tls_queue = 0;
+
+struct WorkerArg {
+    ThreadPool *pool;
+    int queue;
+};
+
+} // namespace
+
+ThreadPool::Queue::Queue() : tasks_run(0), steals(0), idle(0) {
+    pthread_mutex_init(&mutex, nullptr);
+}
+
+ThreadPool::Queue::~Queue() {
+    pthread_mutex_destroy(&mutex);
+}
+
+ThreadPool::ThreadPool(int num_workers)
+    : num_workers_(num_workers > 0 ? num_workers : 0),
+      queues_(num_workers_ + 1), task_overhead_(0), queued_(0), sleeping_(0),
+      stop_(false) {
+    pthread_mutex_init(&sleep_mutex_, nullptr);
+
+    threads_.resize(num_workers_);
+    for (int i = 0; i < num_workers_; i++)
+        pthread_create(&threads_[i], nullptr, WorkerMain, new WorkerArg{this, i});
+}
+
+ThreadPool::~ThreadPool() {
+    pthread_mutex_lock(&sleep_mutex_);
+    stop_ = true;
+    while (!sleepers_.empty())
+        Wake(sleepers_.size() - 1);
+    pthread_mutex_unlock(&sleep_mutex_);
+
+    for (pthread_t thread : threads_)
+        pthread_join(thread, nullptr);
+
+    pthread_mutex_destroy(&sleep_mutex_);
+}
+
+ThreadPool::Stats ThreadPool::GetStats() const {
+    Stats stats = {0, 0, 0};
+    for (const Queue &queue : queues_) {
+        stats.tasks += queue.tasks_run.load(std::memory_order_relaxed);
+        stats.steals += queue.steals.load(std::memory_order_relaxed);
+        stats.idle += queue.idle.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void ThreadPool::ResetStats() {
+    for (Queue &queue : queues_) {
+        queue.tasks_run.store(0, std::memory_order_relaxed);
+        queue.steals.store(0, std::memory_order_relaxed);
+        queue.idle.store(0, std::memory_order_relaxed);
+    }
+}
+
+// Threads asking at the same time may each measure; any of the results
+// will do.
+double ThreadPool::TaskOverhead() {
+    double overhead = task_overhead_.load(std::memory_order_relaxed);
+    if (overhead > 0)
+        return overhead;
+
+    // the fastest of a few batches, after one that wakes the workers
+    const int kBatch = 256;
+    const int kRounds = 4;
+    for (int round = 0; round < kRounds; round++) {
+        auto start = std::chrono::steady_clock::now();
+        TaskGroup group(this);
+        for (int i = 0; i < kBatch; i++)
+            group.Run([] {});
+        group.Wait();
+        std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+        double batch = elapsed.count() / kBatch;
+        if (round == 1 || (round > 1 && batch < overhead))
+            overhead = batch;
+    }
+    task_overhead_.store(overhead, std::memory_order_relaxed);
+    return overhead;
+}
+
+ThreadPool *ThreadPool::Default() {
+    static ThreadPool pool(sysconf(_SC_NPROCESSORS_ONLN) - 1);
+    return &pool;
+}
+
+void *ThreadPool::WorkerMain(void *arg) {
+    WorkerArg *worker = static_cast<WorkerArg *>(arg);
+    ThreadPool *pool = worker->pool;
+    tls_pool = pool;
+    tls_queue = worker->queue;
+    delete worker;
+
+    for (;;) {
+        if (pool->TryRunOne())
+            continue;
+        pool->Sleep(nullptr);
+
+        pthread_mutex_lock(&pool->sleep_mutex_);
+        bool stop = pool->stop_;
+        pthread_mutex_unlock(&pool->sleep_mutex_);
+        if (stop)
+            break;
+    }
+    return nullptr;
+}
+
+// workers use their own deque, everybody else the shared last one
+int ThreadPool::QueueIndex() const {
+    return tls_pool == this ? tls_queue : num_workers_;
+}
+
+void ThreadPool::Push(Task task) {
+    Queue &queue = queues_[QueueIndex()];
+    pthread_mutex_lock(&queue.mutex);
+    queue.tasks.push_back(std::move(task));
+    pthread_mutex_unlock(&queue.mutex);
+
+    // count once the task can be taken, so a thread that sees it counted
+    // finds it; a thief may take it first and briefly leave queued_ at -1
+    queued_.fetch_add(1);
+
+    // one task needs one more thread: wake the one that slept last
+    if (sleeping_.load() > 0) {
+        pthread_mutex_lock(&sleep_mutex_);
+        if (!sleepers_.empty())
+            Wake(sleepers_.size() - 1);
+        pthread_mutex_unlock(&sleep_mutex_);
+    }
+}
+
+// run one task from the own deque or stolen from another one, return
+// false if there was none
+bool ThreadPool::TryRunOne() {
+    int self = QueueIndex();
+    int numQueues = queues_.size();
+    Task task;
+    bool found = false;
+    bool stolen = false;
+
+    Queue &own = queues_[self];
+    pthread_mutex_lock(&own.mutex);
+    if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        found = true;
+    }
+    pthread_mutex_unlock(&own.mutex);
+
+    for (int i = 1; !found && i < numQueues; i++) {
+        Queue &victim = queues_[(self + i) % numQueues];
+        pthread_mutex_lock(&victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            found = stolen = true;
+        }
+        pthread_mutex_unlock(&victim.mutex);
+    }
+
+    if (!found)
+        return false;
+
+    queued_.fetch_sub(1);
+    own.tasks_run.fetch_add(1, std::memory_order_relaxed);
+    if (stolen)
+        own.steals.fetch_add(1, std::memory_order_relaxed);
+
+    task.run();
+    task.group->TaskDone();
+    return true;
+}
+
+// block until there are tasks, the pool stops, or (if given) 'pending'
+// drops to zero
+void ThreadPool::Sleep(const std::atomic<int> *pending) {
+    Sleeper self;
+    pthread_cond_init(&self.wake, nullptr);
+    self.pending = pending;
+    self.woken = false;
+
+    pthread_mutex_lock(&sleep_mutex_);
+    // announce first: Push() and TaskDone() change their counter before
+    // looking for sleepers, so one of the two sides sees the other
+    sleeping_.fetch_add(1);
+    sleepers_.push_back(&self);
+
+    bool counted = false;
+    while (!self.woken && queued_.load() <= 0 && !stop_ &&
+           (!pending || pending->load() > 0)) {
+        if (!counted) {
+            queues_[QueueIndex()].idle.fetch_add(1, std::memory_order_relaxed);
+            counted = true;
+        }
+        pthread_cond_wait(&self.wake, &sleep_mutex_);
+    }
+
+    if (!self.woken)
+        sleepers_.erase(std::find(sleepers_.begin(), sleepers_.end(), &self));
+    sleeping_.fetch_sub(1);
+    pthread_mutex_unlock(&sleep_mutex_);
+    pthread_cond_destroy(&self.wake);
+}
+
+// take sleepers_[sleeper] off the list and wake it; sleep_mutex_ held
+void ThreadPool::Wake(size_t sleeper) {
+    Sleeper *woken = sleepers_[sleeper];
+    sleepers_.erase(sleepers_.begin() + sleeper);
+    woken->woken = true;
+    pthread_cond_signal(&woken->wake);
+}
+
+void TaskGroup::Run(std::function<void()> task) {
+    pending_.fetch_add(1);
+    pool_->Push(ThreadPool::Task{std::move(task), this});
+}
+
+void TaskGroup::Wait() {
+    while (pending_.load() > 0) {
+        if (!pool_->TryRunOne())
+            pool_->Sleep(&pending_);
+    }
+}
+
+void TaskGroup::TaskDone() {
+    // the group may be gone as soon as pending_ reaches zero, and only
+    // its owner, if it sleeps in Wait(), has to hear of it
+    ThreadPool *pool = pool_;
+    const std::atomic<int> *pending = &pending_;
+    if (pending_.fetch_sub(1) != 1 || pool->sleeping_.load() == 0)
+        return;
+
+    pthread_mutex_lock(&pool->sleep_mutex_);
+    for (size_t i = 0; i < pool->sleepers_.size(); i++) {
+        if (pool->sleepers_[i]->pending == pending) {
+            pool->Wake(i);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool->sleep_mutex_);
+}
@@ -0,0 +1,166 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <vector>
+
+class TaskGroup;
+
+// ThreadPool
+//
+// Fixed set of worker threads running tasks from per-worker deques. A
+// worker pushes and pops its own tasks at the back, so nested tasks run
+// depth first while their data is still in cache; a worker that runs dry
+// steals from the front of the other deques, where the oldest and
+// usually largest tasks are. Threads outside the pool share one extra
+// deque.
+//
+// Tasks are submitted through a TaskGroup. TaskGroup::Wait() runs queued
+// tasks on the waiting thread rather than blocking it, so the waiter is
+// one more worker, and a pool with no workers at all runs everything
+// inline in Wait().
+//
+class ThreadPool {
+public:
+    // counters since construction or the last ResetStats()
+    struct Stats {
+        uint64_t tasks;   // tasks run
+        uint64_t steals;  // tasks taken from another thread's deque
+        uint64_t idle;    // times a thread ran out of work and slept
+    };
+
+    explicit ThreadPool(int num_workers);
+    ~ThreadPool();
+
+    int num_workers() const { return num_workers_; }
+
+    Stats GetStats() const;
+    void ResetStats();
+
+    // Nanoseconds it takes to run a task on the pool rather than call
+    // it: submitting it, a worker or the waiter taking it, and finishing
+    // it. Measured with batches of empty tasks on the first call, which
+    // count in GetStats().
+    double TaskOverhead();
+
+    // Process-wide pool with one worker per online CPU but one; the
+    // thread waiting on a TaskGroup makes up for it.
+    static ThreadPool *Default();
+
+private:
+    friend class TaskGroup;
+
+    struct Task {
+        std::function<void()> run;
+        TaskGroup *group;
+    };
+
+    // a thread blocked in Sleep(), waiting for its own wakeup
+    struct Sleeper {
+        pthread_cond_t wake;
+        const std::atomic<int> *pending;  // Sleep()'s argument
+        bool woken;                       // taken off sleepers_ by a waker
+    };
+
+    // deque and counters of one thread, padded against false sharing
+    struct alignas(64) Queue {
+        Queue();
+        ~Queue();
+
+        pthread_mutex_t mutex;
+        std::deque<Task> tasks;
+        std::atomic<uint64_t> tasks_run;
+        std::atomic<uint64_t> steals;
+        std::atomic<uint64_t> idle;
+    };
+
+    ThreadPool(const ThreadPool &);
+    ThreadPool &operator=(const ThreadPool &);
+
+    static void *WorkerMain(void *arg);
+
+    int QueueIndex() const;
+    void Push(Task task);
+    bool TryRunOne();
+    void Sleep(const std::atomic<int> *pending);
+    void Wake(size_t sleeper);
+
+    int num_workers_;
+    std::vector<Queue> queues_;      // one per worker, then the outside one
+    std::vector<pthread_t> threads_;
+
+    std::atomic<double> task_overhead_;  // TaskOverhead(), 0 until measured
+    std::atomic<int> queued_;        // tasks in all deques
+    std::atomic<int> sleeping_;      // threads in Sleep()
+    bool stop_;                      // guarded by sleep_mutex_
+    std::vector<Sleeper *> sleepers_;  // guarded by sleep_mutex_
+    pthread_mutex_t sleep_mutex_;
+};
+
+// TaskGroup
+//
+// Set of tasks on a pool that can be waited for together. Tasks may add
+// further tasks to their own group; Wait() returns once all of them are
+// done.
+//
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool *pool) : pool_(pool), pending_(0) {
+    }
+
+    ~TaskGroup() {
+        Wait();
+    }
+
+    ThreadPool *pool() const { return pool_; }
+
+    void Run(std::function<void()> task);
+
+    // Run queued tasks until every task of this group has finished.
+    void Wait();
+
+private:
+    friend class ThreadPool;
+
+    TaskGroup(const TaskGroup &);
+    TaskGroup &operator=(const TaskGroup &);
+
+    void TaskDone();
+
+    ThreadPool *pool_;
+    std::atomic<int> pending_;  // tasks submitted but not finished
+};
+
+// Number of chunks ParallelFor() cuts 'size' items into.
+inline size_t NumChunks(size_t size, size_t grain) {
+    return grain ? (size + grain - 1) / grain : 1;
+}
+
+// Run fn(chunk, begin, end) on the pool for consecutive chunks of about
+// 'grain' items covering [0, size), and return when all have finished.
+// The calling thread runs chunks too.
+template <typename Fn>
+void ParallelFor(ThreadPool *pool, size_t size, size_t grain, const Fn &fn) {
+    size_t chunks = NumChunks(size, grain);
+    if (chunks <= 1) {
+        if (size)
+            fn(0, 0, size);
+        return;
+    }
+
+    TaskGroup group(pool);
+    for (size_t chunk = 1; chunk < chunks; chunk++) {
+        size_t begin = chunk * grain;
+        size_t end = begin + grain < size ? begin + grain : size;
+        group.Run([&fn, chunk, begin, end] { fn(chunk, begin, end); });
+    }
+    fn(0, 0, grain);
+    group.Wait();
+}
+
+#endif // THREAD_POOL_H_
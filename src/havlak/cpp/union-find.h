@@ -0,0 +1,68 @@
+#ifndef UNION_FIND_H_
+#define UNION_FIND_H_
+
+#include <stdint.h>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+// UnionFind
+//
+// Disjoint-set forest over the dense indices [0, size), after Tarjan,
+// R.E., 1983, Data Structures and Network Algorithms. Parents and ranks
+// live in two flat arrays; Find() does path halving and Union() links
+// by rank, both in place, so neither touches the heap. With both
+// heuristics any sequence of operations runs in near-linear time.
+//
+// Union() picks the representative by rank, so callers that need a
+// particular element to name a set (Havlak's loop headers) keep that
+// name in a side array indexed by representative.
+//
+template <typename Index>
+class UnionFind {
+public:
+    explicit UnionFind(std::pmr::memory_resource *memory =
+                           std::pmr::get_default_resource())
+        : parent_(memory), rank_(memory) {
+    }
+
+    // Make every element in [0, size) a singleton set again. Reuses the
+    // arrays' capacity.
+    void Reset(Index size) {
+        parent_.resize(size);
+        rank_.assign(size, 0);
+        for (Index i = 0; i < size; ++i)
+            parent_[i] = i;
+    }
+
+    Index size() const { return parent_.size(); }
+
+    // Representative of the set containing x.
+    Index Find(Index x) {
+        while (parent_[x] != x) {
+            parent_[x] = parent_[parent_[x]];  // path halving
+            x = parent_[x];
+        }
+        return x;
+    }
+
+    // Merge the sets containing a and b, return the new representative.
+    Index Union(Index a, Index b) {
+        a = Find(a);
+        b = Find(b);
+        if (a == b)
+            return a;
+        if (rank_[a] < rank_[b])
+            std::swap(a, b);
+        parent_[b] = a;
+        if (rank_[a] == rank_[b])
+            ++rank_[a];
+        return a;
+    }
+
+private:
+    std::pmr::vector<Index> parent_;
+    std::pmr::vector<uint8_t> rank_;  // rank is at most log2(size)
+};
+
+#endif // UNION_FIND_H_